@@ -1,5 +1,45 @@
 LOCAL_PATH := $(call my-dir)
 
+versioner_cflags := -Wall -Wextra -Wno-unused-parameter
+versioner_cflags += -D__STDC_CONSTANT_MACROS -D__STDC_LIMIT_MACROS -fno-rtti
+
+# libversioner: everything but the command line interface, for use by other host tools.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libversioner
+LOCAL_MODULE_HOST_OS := linux
+
+LOCAL_CLANG := true
+LOCAL_RTTI_FLAG := -fno-rtti
+LOCAL_CFLAGS := $(versioner_cflags)
+LOCAL_CPPFLAGS := $(LOCAL_CFLAGS) -std=c++14
+
+LOCAL_SRC_FILES := \
+  src/Annotator.cpp \
+  src/Baseline.cpp \
+  src/Checks.cpp \
+  src/CostDatabase.cpp \
+  src/DeclarationDatabase.cpp \
+  src/DeviceLibraries.cpp \
+  src/Diagnostics.cpp \
+  src/Driver.cpp \
+  src/ElfReader.cpp \
+  src/ElfWriter.cpp \
+  src/FileCache.cpp \
+  src/Flattener.cpp \
+  src/Generator.cpp \
+  src/Metrics.cpp \
+  src/Prescan.cpp \
+  src/QueryServer.cpp \
+  src/Session.cpp \
+  src/SymbolDatabase.cpp \
+  src/Utils.cpp
+
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/src
+LOCAL_SHARED_LIBRARIES := libclang libLLVM
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
 include $(CLEAR_VARS)
 
 LOCAL_MODULE := versioner
@@ -7,11 +47,11 @@ LOCAL_MODULE_HOST_OS := linux
 
 LOCAL_CLANG := true
 LOCAL_RTTI_FLAG := -fno-rtti
-LOCAL_CFLAGS := -Wall -Wextra -Wno-unused-parameter
-LOCAL_CFLAGS += -D__STDC_CONSTANT_MACROS -D__STDC_LIMIT_MACROS -fno-rtti
+LOCAL_CFLAGS := $(versioner_cflags)
 LOCAL_CPPFLAGS := $(LOCAL_CFLAGS) -std=c++14
 
-LOCAL_SRC_FILES := src/versioner.cpp src/DeclarationDatabase.cpp src/SymbolDatabase.cpp src/Utils.cpp
+LOCAL_SRC_FILES := src/versioner.cpp
+LOCAL_STATIC_LIBRARIES := libversioner
 LOCAL_SHARED_LIBRARIES := libclang libLLVM
 
 include $(BUILD_HOST_EXECUTABLE)
@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Annotator.h"
+
+#include <err.h>
+#include <stdio.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Token.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "Diagnostics.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace clang;
+
+static bool is64Bit(const std::string& arch) {
+  const ArchInfo* info = findArch(arch);
+  return info && info->lp64;
+}
+
+// Figure out the annotation needed for a symbol that's currently declared without availability.
+// Returns false if the symbol can't be described with __INTRODUCED_IN (e.g. it was removed, or
+// architectures of the same bitness disagree), and sets annotation to empty if none is needed.
+static bool inferAnnotation(const std::set<CompilationType>& types,
+                            const std::map<CompilationType, NdkSymbolType>& symbol_availability,
+                            std::string* annotation) {
+  // Map from arch to the minimum selected level for that arch, and the first level at which the
+  // symbol exists.
+  std::map<std::string, int> min_levels;
+  std::map<std::string, int> first_levels;
+  for (const CompilationType& type : types) {
+    if (min_levels.count(type.arch) == 0) {
+      min_levels[type.arch] = type.api_level;
+    }
+
+    bool present = symbol_availability.count(type) != 0;
+    bool seen = first_levels.count(type.arch) != 0;
+    if (present && !seen) {
+      first_levels[type.arch] = type.api_level;
+    } else if (!present && seen) {
+      // The symbol was removed, which __INTRODUCED_IN alone can't express.
+      return false;
+    }
+  }
+
+  // Symbols absent on an entire architecture are either arch-specific or inline, so ignore them.
+  int introduced_32 = 0;
+  int introduced_64 = 0;
+  int min_level_32 = 0;
+  int min_level_64 = 0;
+  for (const auto& it : first_levels) {
+    const std::string& arch = it.first;
+    int first_level = it.second;
+    int min_level = min_levels[arch];
+    int& introduced = is64Bit(arch) ? introduced_64 : introduced_32;
+    int& bitness_min_level = is64Bit(arch) ? min_level_64 : min_level_32;
+
+    if (bitness_min_level == 0 || min_level < bitness_min_level) {
+      bitness_min_level = min_level;
+    }
+
+    if (first_level == min_level) {
+      continue;
+    }
+
+    if (introduced != 0 && introduced != first_level) {
+      return false;
+    }
+    introduced = first_level;
+  }
+
+  // Prefer a single __INTRODUCED_IN when it's accurate for both bitnesses.
+  if (introduced_32 == 0 && introduced_64 == 0) {
+    annotation->clear();
+  } else if (introduced_32 == introduced_64) {
+    *annotation = "__INTRODUCED_IN(" + std::to_string(introduced_32) + ")";
+  } else if (introduced_64 == 0 && (min_level_64 == 0 || introduced_32 <= min_level_64)) {
+    *annotation = "__INTRODUCED_IN(" + std::to_string(introduced_32) + ")";
+  } else if (introduced_32 == 0 && (min_level_32 == 0 || introduced_64 <= min_level_32)) {
+    *annotation = "__INTRODUCED_IN(" + std::to_string(introduced_64) + ")";
+  } else {
+    std::vector<std::string> annotations;
+    if (introduced_32 != 0) {
+      annotations.push_back("__INTRODUCED_IN_32(" + std::to_string(introduced_32) + ")");
+    }
+    if (introduced_64 != 0) {
+      annotations.push_back("__INTRODUCED_IN_64(" + std::to_string(introduced_64) + ")");
+    }
+    *annotation = Join(annotations, " ");
+  }
+  return true;
+}
+
+bool findTerminator(StringRef buffer, unsigned offset, unsigned* result) {
+  LangOptions lang_opts;
+  lang_opts.C11 = true;
+  lang_opts.GNUMode = true;
+  lang_opts.LineComment = true;
+
+  // Token locations are offsets from this fake location, as in Lexer::ComputePreamble.
+  SourceLocation base = SourceLocation::getFromRawEncoding(1);
+  Lexer lexer(base, lang_opts, buffer.begin(), buffer.begin() + offset, buffer.end());
+
+  int depth = 0;
+  Token token;
+  while (true) {
+    lexer.LexFromRawLexer(token);
+    switch (token.getKind()) {
+      case tok::eof:
+      case tok::l_brace:
+      case tok::hash:
+        return false;
+
+      case tok::l_paren:
+        ++depth;
+        break;
+
+      case tok::r_paren:
+        --depth;
+        break;
+
+      case tok::semi:
+        if (depth == 0) {
+          *result = token.getLocation().getRawEncoding() - base.getRawEncoding();
+          return true;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+}
+
+// An annotation to add to a declaration.
+struct AnnotationEdit {
+  std::string symbol_name;
+  std::string annotation;
+  const DeclarationLocation* location;
+};
+
+static void reportLocation(DiagnosticSink& sink, DiagnosticCode code,
+                           const std::string& symbol_name, const DeclarationLocation& location,
+                           std::string message) {
+  Diagnostic diagnostic;
+  diagnostic.code = code;
+  diagnostic.symbol = symbol_name;
+  diagnostic.message = std::move(message);
+  diagnostic.filename = location.filename;
+  diagnostic.line_number = location.line_number;
+
+  Declaration declaration;
+  declaration.name = symbol_name;
+  declaration.locations = { location };
+  diagnostic.declarations = { std::move(declaration) };
+  sink.report(std::move(diagnostic));
+}
+
+bool annotateHeaders(const std::set<CompilationType>& types,
+                     const DeclarationDatabase& declaration_database,
+                     const NdkSymbolDatabase& symbol_database, DiagnosticSink& sink) {
+  PhaseTimer phase_timer("annotate");
+  bool failed = false;
+
+  // Map from the file that the offsets are into, to a map from declarator end offset to the edit
+  // to make there.
+  std::map<std::string, std::map<unsigned, AnnotationEdit>> edits;
+
+  for (const auto& outer : declaration_database) {
+    const std::string& symbol_name = outer.first;
+
+    auto symbol_it = symbol_database.find(symbol_name);
+    if (symbol_it == symbol_database.end()) {
+      continue;
+    }
+
+    bool annotated = false;
+    bool defined = false;
+    std::set<const DeclarationLocation*> locations;
+    for (const DeclarationRange& range : outer.second.getRanges()) {
+      defined |= range.declaration->hasDefinition();
+      for (const DeclarationLocation& location : range.declaration->locations) {
+        annotated |= !location.availability.empty();
+        locations.insert(&location);
+      }
+    }
+
+    // Leave existing annotations alone, and inline definitions don't need a symbol.
+    if (annotated || defined) {
+      continue;
+    }
+
+    std::string annotation;
+    if (!inferAnnotation(types, symbol_it->second, &annotation)) {
+      Diagnostic diagnostic;
+      diagnostic.code = DiagnosticCode::annotation_not_inferred;
+      diagnostic.symbol = symbol_name;
+      diagnostic.message = "unable to infer availability from the platforms";
+      sink.report(std::move(diagnostic));
+      failed = true;
+      continue;
+    }
+
+    if (annotation.empty()) {
+      continue;
+    }
+
+    for (const DeclarationLocation* location : locations) {
+      if (location->end_offset == 0) {
+        reportLocation(sink, DiagnosticCode::unlocatable_declaration, symbol_name, *location,
+                       "unable to locate the declaration, so it can't be annotated");
+        failed = true;
+        continue;
+      }
+      edits[location->offset_filename][location->end_offset] = { symbol_name, annotation,
+                                                                  location };
+    }
+  }
+
+  for (const auto& file_edits : edits) {
+    const std::string& filename = file_edits.first;
+    auto buffer = llvm::MemoryBuffer::getFile(filename);
+    if (std::error_code ec = buffer.getError()) {
+      errx(1, "failed to read header '%s': %s", filename.c_str(), ec.message().c_str());
+    }
+
+    StringRef contents = buffer.get()->getBuffer();
+    std::string result;
+    result.reserve(contents.size() + file_edits.second.size() * 24);
+
+    // Only diagnostics go to stdout, so that it stays machine-readable with -j.
+    fprintf(stderr, "%s:\n", filename.c_str());
+    size_t copied = 0;
+    for (const auto& edit : file_edits.second) {
+      const std::string& symbol_name = edit.second.symbol_name;
+      const std::string& annotation = edit.second.annotation;
+      unsigned terminator;
+      if (edit.first < copied || edit.first > contents.size() ||
+          !findTerminator(contents, edit.first, &terminator)) {
+        reportLocation(sink, DiagnosticCode::declaration_end_not_found, symbol_name,
+                       *edit.second.location,
+                       "failed to find the end of the declaration, so it can't be annotated");
+        failed = true;
+        continue;
+      }
+
+      result.append(contents.data() + copied, terminator - copied);
+      result.append(" ");
+      result.append(annotation);
+      copied = terminator;
+      fprintf(stderr, "    %s: %s\n", symbol_name.c_str(), annotation.c_str());
+    }
+    result.append(contents.data() + copied, contents.size() - copied);
+
+    std::string tmp_path = filename + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "w");
+    if (!f) {
+      err(1, "failed to open '%s' for writing", tmp_path.c_str());
+    }
+    if (fwrite(result.data(), 1, result.size(), f) != result.size() || fclose(f) != 0) {
+      err(1, "failed to write '%s'", tmp_path.c_str());
+    }
+    if (rename(tmp_path.c_str(), filename.c_str()) != 0) {
+      err(1, "failed to rename '%s' to '%s'", tmp_path.c_str(), filename.c_str());
+    }
+  }
+
+  return !failed;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <set>
+
+#include "llvm/ADT/StringRef.h"
+
+#include "DeclarationDatabase.h"
+#include "Diagnostics.h"
+#include "SymbolDatabase.h"
+
+// Add __INTRODUCED_IN annotations to the declarations of symbols without any availability that
+// aren't present in every platform, using the levels at which they first appear in the platforms.
+// Edits are batched, and each modified header is written exactly once.
+// Annotations that couldn't be inferred or applied are reported to sink, and make this return
+// false.
+bool annotateHeaders(const std::set<CompilationType>& types,
+                     const DeclarationDatabase& declaration_database,
+                     const NdkSymbolDatabase& symbol_database, DiagnosticSink& sink);
+
+// Find the semicolon that terminates the declaration whose declarator ends at offset in buffer,
+// skipping over any attributes in between. Returns false if the declaration doesn't end there.
+bool findTerminator(llvm::StringRef buffer, unsigned offset, unsigned* result);
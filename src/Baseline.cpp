@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Baseline.h"
+
+#include <err.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "Metrics.h"
+#include "Utils.h"
+
+using namespace llvm;
+
+struct TreeIndex {
+  // Map from relative path to a hash of the contents.
+  std::unordered_map<std::string, size_t> hashes;
+
+  // Map from relative path to the relative paths of the headers in the tree that it includes.
+  std::unordered_map<std::string, std::vector<std::string>> includes;
+};
+
+static std::string parentDirectory(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+}
+
+// Find the names of the headers included by a file, without preprocessing it: conditional
+// inclusion is ignored, which can only make us reparse more than we need to.
+static void scanIncludes(StringRef contents, std::vector<std::pair<std::string, bool>>* result) {
+  while (!contents.empty()) {
+    StringRef line;
+    std::tie(line, contents) = contents.split('\n');
+    line = line.ltrim();
+    if (!line.startswith("#")) {
+      continue;
+    }
+
+    line = line.drop_front().ltrim();
+    if (!line.startswith("include")) {
+      continue;
+    }
+
+    line = line.drop_front(strlen("include")).ltrim();
+    if (line.empty() || (line[0] != '<' && line[0] != '"')) {
+      continue;
+    }
+
+    bool quoted = line[0] == '"';
+    size_t end = line.find(quoted ? '"' : '>', 1);
+    if (end != StringRef::npos) {
+      result->emplace_back(line.slice(1, end).str(), quoted);
+    }
+  }
+}
+
+static TreeIndex indexTree(const std::string& header_dir) {
+  TreeIndex result;
+  std::map<std::string, std::vector<std::pair<std::string, bool>>> raw_includes;
+
+  for (const std::string& path : collectFiles(header_dir)) {
+    auto buffer = MemoryBuffer::getFile(path);
+    if (std::error_code ec = buffer.getError()) {
+      errx(1, "failed to read header '%s': %s", path.c_str(), ec.message().c_str());
+    }
+
+    StringRef contents = buffer.get()->getBuffer();
+    std::string relative = getRelativePath(path, header_dir);
+    result.hashes[relative] = hash_value(contents);
+    scanIncludes(contents, &raw_includes[relative]);
+  }
+
+  // Resolve includes against the tree, as the compiler would with it on the include path. Anything
+  // that doesn't resolve comes from the dependencies, which the trees share.
+  for (const auto& it : raw_includes) {
+    std::vector<std::string>& resolved = result.includes[it.first];
+    for (const auto& include : it.second) {
+      std::string candidate = parentDirectory(it.first) + include.first;
+      if (include.second && result.hashes.count(candidate) != 0) {
+        resolved.push_back(candidate);
+      } else if (result.hashes.count(include.first) != 0) {
+        resolved.push_back(include.first);
+      }
+    }
+  }
+
+  return result;
+}
+
+// Add every header that transitively includes one in changed to it.
+static void propagateChanges(const TreeIndex& tree, std::set<std::string>* changed) {
+  std::unordered_map<std::string, std::vector<std::string>> includers;
+  for (const auto& it : tree.includes) {
+    for (const std::string& include : it.second) {
+      includers[include].push_back(it.first);
+    }
+  }
+
+  std::vector<std::string> worklist(changed->begin(), changed->end());
+  while (!worklist.empty()) {
+    std::string header = std::move(worklist.back());
+    worklist.pop_back();
+
+    auto it = includers.find(header);
+    if (it == includers.end()) {
+      continue;
+    }
+
+    for (const std::string& includer : it->second) {
+      if (changed->insert(includer).second) {
+        worklist.push_back(includer);
+      }
+    }
+  }
+}
+
+std::set<std::string> findChangedHeaders(const std::string& old_header_dir,
+                                         const std::string& new_header_dir) {
+  PhaseTimer phase_timer("baseline_index");
+  TreeIndex old_tree = indexTree(old_header_dir);
+  TreeIndex new_tree = indexTree(new_header_dir);
+
+  std::set<std::string> changed;
+  for (const auto& it : new_tree.hashes) {
+    auto old_it = old_tree.hashes.find(it.first);
+    if (old_it == old_tree.hashes.end() || old_it->second != it.second) {
+      changed.insert(it.first);
+    }
+  }
+
+  for (const auto& it : old_tree.hashes) {
+    if (new_tree.hashes.count(it.first) == 0) {
+      changed.insert(it.first);
+    }
+  }
+
+  propagateChanges(old_tree, &changed);
+  propagateChanges(new_tree, &changed);
+
+  uint64_t reused = 0;
+  for (const auto& it : new_tree.hashes) {
+    reused += changed.count(it.first) == 0;
+  }
+  run_metrics.add(RunCounter::headers_reused, reused);
+  return changed;
+}
+
+enum class AvailabilityChange {
+  added,
+  removed,
+  changed,
+};
+
+bool diffDeclarations(const std::set<CompilationType>& types,
+                      const DeclarationDatabase& old_database,
+                      const DeclarationDatabase& new_database, DiagnosticSink& sink) {
+  std::set<std::string> symbols;
+  for (const auto& it : old_database) {
+    symbols.insert(it.first);
+  }
+  for (const auto& it : new_database) {
+    symbols.insert(it.first);
+  }
+
+  bool identical = true;
+  for (const std::string& symbol_name : symbols) {
+    // Group the types with the same change together, so that a symbol whose availability changed
+    // the same way everywhere is only reported once.
+    using Change = std::tuple<AvailabilityChange, std::string, std::string>;
+    std::map<Change, std::vector<CompilationType>> changes;
+    std::map<Change, const Declaration*> change_declarations;
+
+    for (const CompilationType& type : types) {
+      const Declaration* before = old_database.find(symbol_name, type);
+      const Declaration* after = new_database.find(symbol_name, type);
+      if (!before && !after) {
+        continue;
+      }
+
+      std::string before_availability;
+      std::string after_availability;
+      AvailabilityChange change;
+      if (!before) {
+        change = AvailabilityChange::added;
+        after_availability = after->locations.begin()->availability.describe();
+      } else if (!after) {
+        change = AvailabilityChange::removed;
+        before_availability = before->locations.begin()->availability.describe();
+      } else {
+        const DeclarationAvailability& old_availability = before->locations.begin()->availability;
+        const DeclarationAvailability& new_availability = after->locations.begin()->availability;
+        if (old_availability == new_availability) {
+          continue;
+        }
+        change = AvailabilityChange::changed;
+        before_availability = old_availability.describe();
+        after_availability = new_availability.describe();
+      }
+
+      Change key(change, before_availability, after_availability);
+      changes[key].push_back(type);
+      change_declarations[key] = after ? after : before;
+    }
+
+    for (auto& it : changes) {
+      AvailabilityChange change;
+      std::string before_availability;
+      std::string after_availability;
+      std::tie(change, before_availability, after_availability) = it.first;
+
+      std::vector<std::string> type_names;
+      for (const CompilationType& type : it.second) {
+        type_names.push_back(type.describe());
+      }
+
+      Diagnostic diagnostic;
+      diagnostic.severity = DiagnosticSeverity::note;
+      diagnostic.symbol = symbol_name;
+      diagnostic.types = std::move(it.second);
+      diagnostic.declarations = { *change_declarations[it.first] };
+
+      std::string where = " in [" + Join(type_names, ", ") + "]";
+      switch (change) {
+        case AvailabilityChange::added:
+          diagnostic.code = DiagnosticCode::availability_added;
+          diagnostic.message = "added" + where + " as " + after_availability;
+          break;
+
+        case AvailabilityChange::removed:
+          diagnostic.code = DiagnosticCode::availability_removed;
+          diagnostic.message = "removed" + where + ", was " + before_availability;
+          break;
+
+        case AvailabilityChange::changed:
+          diagnostic.code = DiagnosticCode::availability_changed;
+          diagnostic.message =
+            "availability changed" + where + " from " + before_availability + " to " +
+            after_availability;
+          break;
+      }
+
+      sink.report(std::move(diagnostic));
+      identical = false;
+    }
+  }
+
+  return identical;
+}
@@ -0,0 +1,585 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Checks.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace std::string_literals;
+
+static Diagnostic makeDiagnostic(DiagnosticCode code, const std::string& symbol,
+                                 const std::string& message,
+                                 std::vector<CompilationType> types = {}) {
+  Diagnostic result;
+  result.code = code;
+  result.symbol = symbol;
+  result.message = message;
+  result.types = std::move(types);
+  return result;
+}
+
+// Architectures with the same data model should have the same prototypes. They often differ
+// deliberately, though, so only mention it if asked. arch_ranges has the first range of each
+// architecture that a symbol is declared in.
+static void checkArchPrototypes(const std::string& symbol_name,
+                                const std::vector<const DeclarationRange*>& arch_ranges,
+                                DiagnosticSink& sink) {
+  if (!verbose) {
+    return;
+  }
+
+  for (size_t i = 0; i < arch_ranges.size(); ++i) {
+    for (size_t j = i + 1; j < arch_ranges.size(); ++j) {
+      const DeclarationRange& lhs = *arch_ranges[i];
+      const DeclarationRange& rhs = *arch_ranges[j];
+      if (findArch(lhs.arch)->lp64 != findArch(rhs.arch)->lp64 ||
+          lhs.declaration->locations.begin()->signature_hash ==
+            rhs.declaration->locations.begin()->signature_hash) {
+        continue;
+      }
+
+      Diagnostic diagnostic =
+        makeDiagnostic(DiagnosticCode::signature_mismatch, symbol_name,
+                       "prototype differs between " + lhs.arch + " and " + rhs.arch);
+      diagnostic.severity = DiagnosticSeverity::warning;
+      diagnostic.declarations = { *lhs.declaration, *rhs.declaration };
+      sink.report(std::move(diagnostic));
+    }
+  }
+}
+
+// The architectures of a set of types.
+static std::set<std::string> getArchs(const std::set<CompilationType>& types) {
+  std::set<std::string> result;
+  for (const CompilationType& type : types) {
+    result.insert(type.arch);
+  }
+  return result;
+}
+
+// Whether any of the types that a range covers are in types.
+static bool rangeHasTypes(const DeclarationDatabase& database, const DeclarationRange& range,
+                          const std::set<CompilationType>& types) {
+  for (const CompilationType& type : database.expand(range)) {
+    if (types.count(type) != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool sanityCheck(const std::set<CompilationType>& types, const DeclarationDatabase& database,
+                 DiagnosticSink& sink) {
+  // This runs for each architecture as soon as it's compiled, so don't expand the ranges of the
+  // others.
+  std::set<std::string> archs = getArchs(types);
+
+  bool error = false;
+  for (const auto& outer : database) {
+    const std::string& symbol_name = outer.first;
+    const DeclarationRange* last_range = nullptr;
+    DeclarationAvailability last_availability;
+
+    // The first declaration of each architecture, for comparing prototypes across them.
+    std::vector<const DeclarationRange*> arch_ranges;
+
+    // Identical declarations across levels share a range, so each only needs to be checked once.
+    for (const DeclarationRange& range : outer.second.getRanges()) {
+      if (archs.count(range.arch) == 0) {
+        continue;
+      }
+
+      std::vector<CompilationType> range_types;
+      for (const CompilationType& type : database.expand(range)) {
+        if (types.count(type) != 0) {
+          range_types.push_back(type);
+        }
+      }
+
+      if (range_types.empty()) {
+        continue;
+      }
+
+      const Declaration& declaration = *range.declaration;
+      bool availability_mismatch = false;
+      DeclarationAvailability current_availability = declaration.locations.begin()->availability;
+
+      // Make sure that all of the availability declarations for this symbol match.
+      for (const DeclarationLocation& location : declaration.locations) {
+        if (current_availability != location.availability) {
+          availability_mismatch = true;
+          error = true;
+        }
+      }
+
+      if (availability_mismatch) {
+        Diagnostic diagnostic =
+          makeDiagnostic(DiagnosticCode::inconsistent_declarations, symbol_name,
+                         "availability mismatch for " + range.describe(), range_types);
+        diagnostic.declarations = { declaration };
+        sink.report(std::move(diagnostic));
+      }
+
+      // Make sure that availability declarations are consistent across API levels for a given arch.
+      if (last_range && last_range->arch == range.arch &&
+          last_availability != current_availability) {
+        error = true;
+
+        CompilationType last_type = { .arch = last_range->arch,
+                                      .api_level = last_range->last_level };
+        sink.report(makeDiagnostic(
+          DiagnosticCode::inconsistent_across_levels, symbol_name,
+          "availability mismatch between " + last_type.describe() + " and " +
+            range_types.front().describe() + ": " + last_availability.describe() + " before, " +
+            current_availability.describe() + " after",
+          { last_type, range_types.front() }));
+      }
+
+      // Prototypes that change between API levels are suspicious, but not necessarily wrong.
+      uint64_t signature_hash = declaration.locations.begin()->signature_hash;
+      if (last_range && last_range->arch == range.arch &&
+          last_range->declaration->locations.begin()->signature_hash != signature_hash) {
+        CompilationType last_type = { .arch = last_range->arch,
+                                      .api_level = last_range->last_level };
+        Diagnostic diagnostic = makeDiagnostic(
+          DiagnosticCode::signature_mismatch, symbol_name,
+          "prototype differs between " + last_type.describe() + " and " +
+            range_types.front().describe(),
+          { last_type, range_types.front() });
+        diagnostic.severity = DiagnosticSeverity::warning;
+        diagnostic.declarations = { *last_range->declaration, declaration };
+        sink.report(std::move(diagnostic));
+      }
+
+      if (!last_range || last_range->arch != range.arch) {
+        arch_ranges.push_back(&range);
+      }
+
+      last_range = &range;
+      last_availability = current_availability;
+    }
+
+    checkArchPrototypes(symbol_name, arch_ranges, sink);
+  }
+  return !error;
+}
+
+void checkPrototypesAcrossArchs(const std::set<CompilationType>& types,
+                                const DeclarationDatabase& database, DiagnosticSink& sink) {
+  if (!verbose) {
+    return;
+  }
+
+  std::set<std::string> archs = getArchs(types);
+  for (const auto& outer : database) {
+    std::vector<const DeclarationRange*> arch_ranges;
+    for (const DeclarationRange& range : outer.second.getRanges()) {
+      if ((arch_ranges.empty() || arch_ranges.back()->arch != range.arch) &&
+          archs.count(range.arch) != 0 && rangeHasTypes(database, range, types)) {
+        arch_ranges.push_back(&range);
+      }
+    }
+    checkArchPrototypes(outer.first, arch_ranges, sink);
+  }
+}
+
+// A symbol that's declared in the headers, present in the platform, or both.
+struct SymbolJoinRow {
+  const std::string* symbol_name;
+  const SymbolDeclarations* declarations;
+  const std::map<CompilationType, NdkSymbolType>* platform;
+};
+
+// Join the declarations and the platform symbols by name. Both are sorted by name, so this is a
+// single merge pass, and the rows are in name order.
+static std::vector<SymbolJoinRow> joinSymbols(const DeclarationDatabase& declaration_database,
+                                              const NdkSymbolDatabase& symbol_database) {
+  std::vector<SymbolJoinRow> result;
+  auto decl_it = declaration_database.begin();
+  auto symbol_it = symbol_database.begin();
+  while (decl_it != declaration_database.end() || symbol_it != symbol_database.end()) {
+    SymbolJoinRow row = {};
+    if (symbol_it == symbol_database.end() ||
+        (decl_it != declaration_database.end() && decl_it->first < symbol_it->first)) {
+      row.symbol_name = &decl_it->first;
+      row.declarations = &decl_it->second;
+      ++decl_it;
+    } else if (decl_it == declaration_database.end() || symbol_it->first < decl_it->first) {
+      row.symbol_name = &symbol_it->first;
+      row.platform = &symbol_it->second;
+      ++symbol_it;
+    } else {
+      row.symbol_name = &decl_it->first;
+      row.declarations = &decl_it->second;
+      row.platform = &symbol_it->second;
+      ++decl_it;
+      ++symbol_it;
+    }
+    result.push_back(row);
+  }
+  return result;
+}
+
+// Finds the declaration ranges containing a sequence of increasing CompilationTypes.
+class RangeCursor {
+  const std::vector<DeclarationRange>& ranges;
+  size_t index = 0;
+
+ public:
+  explicit RangeCursor(const std::vector<DeclarationRange>& ranges) : ranges(ranges) {
+  }
+
+  const Declaration* find(const CompilationType& type) {
+    while (index < ranges.size() && std::tie(ranges[index].arch, ranges[index].last_level) <
+                                      std::tie(type.arch, type.api_level)) {
+      ++index;
+    }
+    if (index < ranges.size() && ranges[index].contains(type)) {
+      return ranges[index].declaration.get();
+    }
+    return nullptr;
+  }
+};
+
+using AvailabilityMismatch =
+  std::tuple<std::string, unsigned int, std::string, CompilationType, std::string>;
+
+struct VersionCheckResults {
+  bool failed = false;
+
+  // Problems with declarations that aren't backed by the platform.
+  std::vector<Diagnostic> declared;
+
+  // Problems with platform symbols that aren't declared properly.
+  std::vector<Diagnostic> exported;
+  std::vector<AvailabilityMismatch> mismatches;
+};
+
+// Make sure that the platform has the symbols that a declaration claims to be available.
+static void checkDeclaredSymbol(const DeclarationDatabase& declaration_database,
+                                const SymbolJoinRow& row, VersionCheckResults* results) {
+  const std::string& symbol_name = *row.symbol_name;
+  const std::set<CompilationType>& compiled_types = declaration_database.compilationTypes();
+  const std::vector<DeclarationRange>& ranges = row.declarations->getRanges();
+  RangeCursor cursor(ranges);
+
+  std::set<std::string> missing_types;
+  size_t total_types = 0;
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    // Use the declaration at the lowest API level of each arch.
+    if (i != 0 && ranges[i].arch == ranges[i - 1].arch) {
+      continue;
+    }
+
+    const std::string& arch = ranges[i].arch;
+    const Declaration& declaration = *ranges[i].declaration;
+    const DeclarationAvailability& availability = declaration.locations.begin()->availability;
+    std::map<CompilationType, NdkSymbolType>::const_iterator platform_it;
+    if (row.platform) {
+      platform_it = row.platform->begin();
+    }
+
+    int min_api = archMinApi(arch);
+    for (int api_level : supported_level_list) {
+      if (api_level < min_api) {
+        continue;
+      }
+
+      if (availability.introduced != 0 && api_level < availability.introduced) {
+        continue;
+      } else if (availability.obsoleted != 0 && api_level >= availability.obsoleted) {
+        continue;
+      }
+
+      ++total_types;
+
+      CompilationType type = { .arch = arch, .api_level = api_level };
+      if (!row.platform) {
+        if (verbose) {
+          results->declared.push_back(makeDiagnostic(DiagnosticCode::not_in_any_platform,
+                                                     symbol_name, "not available in any platform"));
+          results->failed = true;
+        }
+        break;
+      }
+
+      while (platform_it != row.platform->end() && platform_it->first < type) {
+        ++platform_it;
+      }
+
+      if (platform_it == row.platform->end() || !(platform_it->first == type)) {
+        // Check to see if the symbol exists as an inline definition.
+        const Declaration* type_declaration =
+          compiled_types.count(type) != 0 ? cursor.find(type) : nullptr;
+        if (!type_declaration) {
+          results->declared.push_back(makeDiagnostic(DiagnosticCode::missing_declaration,
+                                                     symbol_name,
+                                                     "symbol not available in " + type.describe(),
+                                                     { type }));
+          continue;
+        }
+
+        if (!type_declaration->hasDefinition()) {
+          missing_types.insert(type.describe());
+          results->failed = true;
+        }
+        continue;
+      }
+
+      switch (platform_it->second) {
+        case NdkSymbolType::function:
+          if (declaration.type() != DeclarationType::function) {
+            results->declared.push_back(
+              makeDiagnostic(DiagnosticCode::symbol_type_mismatch, symbol_name,
+                             "symbol exists as function, declared as "s +
+                               declarationTypeName(declaration.type()),
+                             { type }));
+          }
+          break;
+
+        case NdkSymbolType::variable:
+          if (declaration.type() != DeclarationType::variable) {
+            results->declared.push_back(
+              makeDiagnostic(DiagnosticCode::symbol_type_mismatch, symbol_name,
+                             "symbol exists as variable, declared as "s +
+                               declarationTypeName(declaration.type()),
+                             { type }));
+          }
+          break;
+      }
+    }
+  }
+
+  if (!missing_types.empty()) {
+    // If the symbol is missing everywhere, only warn if verbose.
+    if (missing_types.size() != total_types || verbose) {
+      results->declared.push_back(makeDiagnostic(DiagnosticCode::missing_symbol, symbol_name,
+                                                 "missing in [" + Join(missing_types, ", ") +
+                                                   "]"));
+    }
+  }
+}
+
+// Make sure that we expose declarations for all available versions of a platform symbol.
+static void checkExportedSymbol(const SymbolJoinRow& row, VersionCheckResults* results) {
+  const std::string& symbol_name = *row.symbol_name;
+  RangeCursor cursor(row.declarations->getRanges());
+  std::set<std::string> warned_archs;
+
+  for (const auto& inner : *row.platform) {
+    const CompilationType& type = inner.first;
+    const Declaration* declaration = cursor.find(type);
+    if (!declaration) {
+      results->exported.push_back(makeDiagnostic(DiagnosticCode::missing_declaration, symbol_name,
+                                                 "failed to find declaration for " +
+                                                   type.describe(),
+                                                 { type }));
+      results->failed = true;
+      continue;
+    }
+
+    const DeclarationAvailability& availability = declaration->locations.begin()->availability;
+    if ((availability.introduced > 0 && availability.introduced > type.api_level) ||
+        (availability.obsoleted > 0 && availability.obsoleted <= type.api_level)) {
+      if (warned_archs.count(type.arch)) {
+        continue;
+      }
+
+      const DeclarationLocation& location = *declaration->locations.begin();
+      results->mismatches.emplace_back(location.filename, location.line_number, symbol_name, type,
+                                       availability.describe());
+      warned_archs.insert(type.arch);
+      results->failed = true;
+    }
+  }
+}
+
+bool checkVersions(const std::set<CompilationType>&,
+                   const DeclarationDatabase& declaration_database,
+                   const NdkSymbolDatabase& symbol_database, DiagnosticSink& sink) {
+  std::vector<SymbolJoinRow> rows = joinSymbols(declaration_database, symbol_database);
+
+  // Check the rows in parallel, in chunks whose results are reported in order afterwards, so that
+  // the output doesn't depend on scheduling.
+  constexpr size_t chunk_size = 256;
+  size_t chunk_count = (rows.size() + chunk_size - 1) / chunk_size;
+  std::vector<VersionCheckResults> results(chunk_count);
+  ParallelFor(chunk_count, [&](size_t chunk) {
+    size_t end = std::min(rows.size(), (chunk + 1) * chunk_size);
+    for (size_t i = chunk * chunk_size; i < end; ++i) {
+      const SymbolJoinRow& row = rows[i];
+      if (!row.declarations) {
+        // It's okay for a symbol to not be declared at all.
+        continue;
+      }
+
+      checkDeclaredSymbol(declaration_database, row, &results[chunk]);
+      if (row.platform) {
+        checkExportedSymbol(row, &results[chunk]);
+      }
+    }
+  });
+
+  bool failed = false;
+  for (VersionCheckResults& result : results) {
+    failed |= result.failed;
+    for (Diagnostic& diagnostic : result.declared) {
+      sink.report(std::move(diagnostic));
+    }
+  }
+
+  std::set<AvailabilityMismatch> mismatches;
+  for (VersionCheckResults& result : results) {
+    for (Diagnostic& diagnostic : result.exported) {
+      sink.report(std::move(diagnostic));
+    }
+    mismatches.insert(result.mismatches.begin(), result.mismatches.end());
+  }
+
+  for (const auto& mismatch : mismatches) {
+    const std::string& filename = std::get<0>(mismatch);
+    const unsigned int line_number = std::get<1>(mismatch);
+    const std::string& symbol_name = std::get<2>(mismatch);
+    const CompilationType& type = std::get<3>(mismatch);
+    const std::string& availability = std::get<4>(mismatch);
+
+    Diagnostic diagnostic =
+      makeDiagnostic(DiagnosticCode::undeclared_availability, symbol_name,
+                     "available in " + type.describe() + ", but availability declared as " +
+                       availability + " (at " + filename + ":" + std::to_string(line_number) + ")",
+                     { type });
+    diagnostic.filename = filename;
+    diagnostic.line_number = line_number;
+    sink.report(std::move(diagnostic));
+  }
+
+  return !failed;
+}
+
+bool checkLanguages(const DeclarationDatabase& c_database, const DeclarationDatabase& cxx_database,
+                    DiagnosticSink& sink) {
+  // A declaration that's missing C linkage has a mangled name in C++, so declarations are matched
+  // up by where they are rather than by name. Map from location to the name that C gives it.
+  using LocationKey = std::tuple<llvm::StringRef, unsigned, unsigned>;
+  std::map<LocationKey, const std::string*> c_names;
+  for (const auto& outer : c_database) {
+    for (const DeclarationRange& range : outer.second.getRanges()) {
+      for (const DeclarationLocation& location : range.declaration->locations) {
+        LocationKey key(location.filename, location.line_number, location.column);
+        c_names.emplace(key, &outer.first);
+      }
+    }
+  }
+
+  bool error = false;
+  for (const auto& outer : cxx_database) {
+    const std::string& cxx_name = outer.first;
+    auto c_symbol = c_database.find(cxx_name);
+
+    // Map from the C name of a declaration that C++ sees as cxx_name to the types that it does so
+    // in, and the declaration from the first of them.
+    std::map<const std::string*, std::pair<std::vector<CompilationType>, const Declaration*>>
+      renamed;
+
+    std::vector<CompilationType> availability_mismatches;
+    std::vector<Declaration> mismatched_declarations;
+
+    for (const DeclarationRange& range : outer.second.getRanges()) {
+      const Declaration& declaration = *range.declaration;
+      std::vector<CompilationType> range_types = cxx_database.expand(range);
+
+      // Inline definitions don't need to link against anything, so their names don't matter.
+      if (!declaration.hasDefinition()) {
+        for (const DeclarationLocation& location : declaration.locations) {
+          LocationKey key(location.filename, location.line_number, location.column);
+          auto it = c_names.find(key);
+          if (!location.is_extern || it == c_names.end() || *it->second == cxx_name) {
+            continue;
+          }
+
+          auto& entry = renamed[it->second];
+          entry.first.insert(entry.first.end(), range_types.begin(), range_types.end());
+          if (!entry.second) {
+            entry.second = &declaration;
+          }
+          break;
+        }
+      }
+
+      if (c_symbol == c_database.end()) {
+        continue;
+      }
+
+      const DeclarationAvailability& cxx_availability = declaration.locations.begin()->availability;
+      for (const CompilationType& type : range_types) {
+        const Declaration* c_declaration = c_symbol->second.find(type.as(CompilationLanguage::c));
+        if (!c_declaration ||
+            c_declaration->locations.begin()->availability == cxx_availability) {
+          continue;
+        }
+
+        if (availability_mismatches.empty()) {
+          mismatched_declarations = { *c_declaration, declaration };
+        }
+        availability_mismatches.push_back(type);
+      }
+    }
+
+    for (auto& it : renamed) {
+      Diagnostic diagnostic =
+        makeDiagnostic(DiagnosticCode::cxx_linkage_mismatch, *it.first,
+                       "declared without C linkage in C++, as " + cxx_name, it.second.first);
+      diagnostic.declarations = { *it.second.second };
+      sink.report(std::move(diagnostic));
+      error = true;
+    }
+
+    if (!availability_mismatches.empty()) {
+      std::string message = "availability differs between C and C++ for " +
+                            availability_mismatches.front().as(CompilationLanguage::c).describe();
+      if (availability_mismatches.size() > 1) {
+        message += " and " + std::to_string(availability_mismatches.size() - 1) + " other types";
+      }
+      Diagnostic diagnostic = makeDiagnostic(DiagnosticCode::cxx_availability_mismatch, cxx_name,
+                                             message, std::move(availability_mismatches));
+      diagnostic.declarations = std::move(mismatched_declarations);
+      sink.report(std::move(diagnostic));
+      error = true;
+    }
+  }
+  return !error;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <set>
+
+#include "DeclarationDatabase.h"
+#include "Diagnostics.h"
+#include "SymbolDatabase.h"
+
+// Make sure that declarations of a symbol agree with each other, both within a single
+// CompilationType and across API levels of an architecture.
+bool sanityCheck(const std::set<CompilationType>& types, const DeclarationDatabase& database,
+                 DiagnosticSink& sink);
+
+// The part of sanityCheck that compares architectures with each other, which reports nothing if
+// types only has one architecture. Running sanityCheck on each architecture's types separately and
+// then this finds the same problems as sanityCheck on all of them.
+void checkPrototypesAcrossArchs(const std::set<CompilationType>& types,
+                                const DeclarationDatabase& database, DiagnosticSink& sink);
+
+// Compare the declared availability of symbols against the symbols in the NDK platforms.
+bool checkVersions(const std::set<CompilationType>& types,
+                   const DeclarationDatabase& declaration_database,
+                   const NdkSymbolDatabase& symbol_database, DiagnosticSink& sink);
+
+// Compare the declarations that the headers make when compiled as C++ (in cxx_database) with the
+// ones they make as C, reporting declarations that lack C linkage in C++, or whose availability
+// differs between the languages.
+bool checkLanguages(const DeclarationDatabase& c_database, const DeclarationDatabase& cxx_database,
+                    DiagnosticSink& sink);
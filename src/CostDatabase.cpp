@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "CostDatabase.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Utils.h"
+
+static bool parseCompilationType(const std::string& str, CompilationType* type) {
+  size_t dash = str.rfind('-');
+  if (dash == std::string::npos || dash == 0) {
+    return false;
+  }
+
+  char* end;
+  const char* level = str.c_str() + dash + 1;
+  long api_level = strtol(level, &end, 10);
+  if (end == level || *end != '\0') {
+    return false;
+  }
+
+  type->arch = str.substr(0, dash);
+  type->api_level = api_level;
+  return true;
+}
+
+bool ParseCostDatabase::load(const std::string& path) {
+  FILE* f = fopen(path.c_str(), "r");
+  if (!f) {
+    if (errno == ENOENT) {
+      return false;
+    }
+    err(1, "failed to open parse cost file '%s'", path.c_str());
+  }
+
+  size_t line_number = 0;
+  while (true) {
+    char* line = nullptr;
+    size_t len = 0;
+    ssize_t rc = getline(&line, &len, f);
+
+    if (rc < 0) {
+      free(line);
+      break;
+    }
+
+    ++line_number;
+    std::string entry = Trim(line);
+    free(line);
+
+    if (entry.empty()) {
+      continue;
+    }
+
+    // Each line is "<arch>-<api level>\t<header>\t<duration in microseconds>".
+    size_t first_tab = entry.find('\t');
+    size_t last_tab = entry.rfind('\t');
+    if (first_tab == std::string::npos || first_tab == last_tab) {
+      errx(1, "%s:%zu: malformed parse cost entry", path.c_str(), line_number);
+    }
+
+    CompilationType type;
+    if (!parseCompilationType(entry.substr(0, first_tab), &type)) {
+      errx(1, "%s:%zu: malformed compilation type", path.c_str(), line_number);
+    }
+
+    std::string header = entry.substr(first_tab + 1, last_tab - first_tab - 1);
+    std::string duration = entry.substr(last_tab + 1);
+
+    char* end;
+    unsigned long long duration_us = strtoull(duration.c_str(), &end, 10);
+    if (end == duration.c_str() || *end != '\0') {
+      errx(1, "%s:%zu: malformed duration", path.c_str(), line_number);
+    }
+
+    costs[type][header] = duration_us;
+  }
+
+  fclose(f);
+  return true;
+}
+
+void ParseCostDatabase::save(const std::string& path) const {
+  // Write to a temporary file and rename it into place, so that an interrupted run doesn't
+  // clobber the history from previous runs.
+  std::string tmp_path = path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    err(1, "failed to open parse cost file '%s' for writing", tmp_path.c_str());
+  }
+
+  for (const auto& outer : costs) {
+    std::string type = outer.first.describe();
+    for (const auto& inner : outer.second) {
+      fprintf(f, "%s\t%s\t%llu\n", type.c_str(), inner.first.c_str(),
+              static_cast<unsigned long long>(inner.second));
+    }
+  }
+
+  if (fclose(f) != 0) {
+    err(1, "failed to write parse cost file '%s'", tmp_path.c_str());
+  }
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    err(1, "failed to rename '%s' to '%s'", tmp_path.c_str(), path.c_str());
+  }
+}
+
+void ParseCostDatabase::record(const CompilationType& type, const std::string& header,
+                               uint64_t duration_us) {
+  costs[type][header] = duration_us;
+}
+
+uint64_t ParseCostDatabase::estimate(
+  const CompilationType& type, const std::vector<std::pair<std::string, uint64_t>>& headers) const {
+  // If there's no history for this exact type, borrow it from the closest API level on the same
+  // architecture, or failing that, from any type at all, so that estimates share the same unit.
+  const std::map<std::string, uint64_t>* history = nullptr;
+  int best_distance = 0;
+  for (const auto& it : costs) {
+    int distance = abs(it.first.api_level - type.api_level);
+    if (it.first.arch != type.arch) {
+      distance += 1000;
+    }
+
+    if (!history || distance < best_distance) {
+      history = &it.second;
+      best_distance = distance;
+    }
+  }
+
+  uint64_t known_cost = 0;
+  uint64_t known_size = 0;
+  uint64_t unknown_size = 0;
+  for (const auto& header : headers) {
+    if (history) {
+      auto it = history->find(header.first);
+      if (it != history->end()) {
+        known_cost += it->second;
+        known_size += header.second;
+        continue;
+      }
+    }
+    unknown_size += header.second;
+  }
+
+  if (unknown_size == 0) {
+    return known_cost;
+  } else if (known_size == 0) {
+    return known_cost + unknown_size;
+  }
+
+  return known_cost + unknown_size * known_cost / known_size;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "DeclarationDatabase.h"
+
+// Observed parse durations (in microseconds) for each header under each CompilationType, persisted
+// between runs so that the most expensive compilation types can be scheduled first.
+class ParseCostDatabase {
+  std::map<CompilationType, std::map<std::string, uint64_t>> costs;
+
+ public:
+  // Returns false if the file doesn't exist. Malformed files are fatal.
+  bool load(const std::string& path);
+  void save(const std::string& path) const;
+
+  void record(const CompilationType& type, const std::string& header, uint64_t duration_us);
+
+  // Estimate the cost of parsing a set of (header, size in bytes) pairs for a given type.
+  // Types without history borrow it from the nearest API level of the same architecture. Headers
+  // without history are estimated from their size, using the observed cost per byte of the headers
+  // that do have history, or a cost of one unit per byte if there's no history at all.
+  uint64_t estimate(const CompilationType& type,
+                    const std::vector<std::pair<std::string, uint64_t>>& headers) const;
+
+  bool empty() const {
+    return costs.empty();
+  }
+};
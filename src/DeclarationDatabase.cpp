@@ -28,48 +28,154 @@
 
 #include "DeclarationDatabase.h"
 
+#include <err.h>
+
+#include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "clang/AST/AST.h"
 #include "clang/AST/Attr.h"
 #include "clang/AST/Mangle.h"
 #include "clang/AST/RecursiveASTVisitor.h"
 #include "clang/Frontend/ASTUnit.h"
+#include "clang/Lex/Lexer.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace clang;
 
+// Signatures are hashed with FNV-1a, so that they're the same in every process.
+static constexpr uint64_t fnv_offset_basis = 0xcbf29ce484222325ULL;
+static constexpr uint64_t fnv_prime = 0x100000001b3ULL;
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * fnv_prime;
+  }
+  return hash;
+}
+
+static uint64_t hashValue(uint64_t hash, uint64_t value) {
+  return hashBytes(hash, &value, sizeof(value));
+}
+
+static uint64_t hashString(uint64_t hash, StringRef string) {
+  return hashValue(hashBytes(hash, string.data(), string.size()), string.size());
+}
+
+// Hash a type as it's written. Sugar is looked through, except for typedefs, whose names are
+// hashed instead of what they stand for: the canonical types of size_t, va_list and the like
+// differ between architectures even when the prototypes that use them don't.
+static uint64_t hashType(uint64_t hash, QualType type) {
+  hash = hashValue(hash, type.getLocalQualifiers().getAsOpaqueValue());
+
+  const Type* t = type.getTypePtr();
+  if (const TypedefType* typedef_type = dyn_cast<TypedefType>(t)) {
+    return hashString(hashValue(hash, Type::Typedef), typedef_type->getDecl()->getName());
+  }
+
+  QualType desugared = t->getLocallyUnqualifiedSingleStepDesugaredType();
+  if (desugared.getTypePtr() != t) {
+    return hashType(hash, desugared);
+  }
+
+  hash = hashValue(hash, t->getTypeClass());
+  if (const BuiltinType* builtin = dyn_cast<BuiltinType>(t)) {
+    return hashValue(hash, builtin->getKind());
+  } else if (const PointerType* pointer = dyn_cast<PointerType>(t)) {
+    return hashType(hash, pointer->getPointeeType());
+  } else if (const BlockPointerType* block_pointer = dyn_cast<BlockPointerType>(t)) {
+    return hashType(hash, block_pointer->getPointeeType());
+  } else if (const ReferenceType* reference = dyn_cast<ReferenceType>(t)) {
+    return hashType(hash, reference->getPointeeType());
+  } else if (const ArrayType* array = dyn_cast<ArrayType>(t)) {
+    if (const ConstantArrayType* constant_array = dyn_cast<ConstantArrayType>(array)) {
+      hash = hashValue(hash, constant_array->getSize().getZExtValue());
+    }
+    return hashType(hash, array->getElementType());
+  } else if (const FunctionType* function = dyn_cast<FunctionType>(t)) {
+    hash = hashType(hash, function->getReturnType());
+    if (const FunctionProtoType* prototype = dyn_cast<FunctionProtoType>(function)) {
+      for (QualType param : prototype->getParamTypes()) {
+        hash = hashType(hash, param);
+      }
+      hash = hashValue(hash, prototype->isVariadic());
+    }
+    return hash;
+  } else if (const TagType* tag = dyn_cast<TagType>(t)) {
+    return hashString(hash, tag->getDecl()->getName());
+  }
+  return hash;
+}
+
 class Visitor : public RecursiveASTVisitor<Visitor> {
   HeaderDatabase& database;
   std::unique_ptr<MangleContext> mangler;
 
- public:
-  Visitor(HeaderDatabase& database, ASTContext& ctx) : database(database) {
-    mangler.reset(ItaniumMangleContext::create(ctx, ctx.getDiagnostics()));
-  }
+  struct CachedName {
+    StringRef name;
+    bool mangled;
+  };
+
+  // Map from canonical declaration to its name, interned in the HeaderDatabase. Headers redeclare
+  // the same functions over and over, so this saves mangling each redeclaration again.
+  llvm::DenseMap<const Decl*, CachedName> names;
 
-  std::string getDeclName(NamedDecl* decl) {
+  StringRef computeDeclName(NamedDecl* decl, bool* mangled) {
+    *mangled = false;
     if (VarDecl* var_decl = dyn_cast<VarDecl>(decl)) {
       if (!var_decl->isFileVarDecl()) {
-        return "<local var>";
+        return database.intern("<local var>");
       }
     }
 
     if (mangler->shouldMangleDeclName(decl)) {
-      std::string mangled;
-      llvm::raw_string_ostream ss(mangled);
+      *mangled = true;
+      llvm::SmallString<64> buffer;
+      llvm::raw_svector_ostream ss(buffer);
       mangler->mangleName(decl, ss);
-      return mangled;
+      return database.intern(ss.str());
     }
 
     auto identifier = decl->getIdentifier();
     if (!identifier) {
-      return "<error>";
+      return database.intern("<error>");
     }
-    return identifier->getName();
+    return database.intern(identifier->getName());
+  }
+
+ public:
+  Visitor(HeaderDatabase& database, ASTContext& ctx) : database(database) {
+    mangler.reset(ItaniumMangleContext::create(ctx, ctx.getDiagnostics()));
+  }
+
+  StringRef getDeclName(NamedDecl* decl) {
+    const Decl* canonical = decl->getCanonicalDecl();
+    auto it = names.find(canonical);
+    if (it != names.end()) {
+      if (it->second.mangled) {
+        ++database.stats.mangles_avoided;
+      }
+      return it->second.name;
+    }
+
+    CachedName result;
+    result.name = computeDeclName(decl, &result.mangled);
+    if (result.mangled) {
+      ++database.stats.mangled_names;
+    }
+    names[canonical] = result;
+    return result.name;
   }
 
   bool VisitDecl(Decl* decl) {
@@ -89,7 +195,6 @@ class Visitor : public RecursiveASTVisitor<Visitor> {
     FunctionDecl* function_decl = dyn_cast<FunctionDecl>(decl);
     VarDecl* var_decl = dyn_cast<VarDecl>(decl);
 
-    std::string declaration_name = getDeclName(named_decl);
     bool is_extern = named_decl->getFormalLinkage() == ExternalLinkage;
     bool is_definition = false;
 
@@ -114,7 +219,7 @@ class Visitor : public RecursiveASTVisitor<Visitor> {
         case VarDecl::TentativeDefinition:
           // Forbid tentative definitions in headers.
           fprintf(stderr, "ERROR: declaration '%s' is a tentative definition\n",
-                  declaration_name.c_str());
+                  getDeclName(named_decl).str().c_str());
           decl->dump();
           abort();
       }
@@ -127,6 +232,8 @@ class Visitor : public RecursiveASTVisitor<Visitor> {
       return true;
     }
 
+    StringRef declaration_name = getDeclName(named_decl);
+
     // Look for availability annotations.
     DeclarationAvailability availability;
     for (const AvailabilityAttr* attr : decl->specific_attrs<AvailabilityAttr>()) {
@@ -146,41 +253,45 @@ class Visitor : public RecursiveASTVisitor<Visitor> {
       }
     }
 
-    // Find or insert an entry for the declaration.
-    auto declaration_it = database.declarations.find(declaration_name);
-    if (declaration_it == database.declarations.end()) {
-      Declaration declaration = {.name = declaration_name };
-      bool inserted;
-      std::tie(declaration_it, inserted) =
-        database.declarations.insert({ declaration_name, declaration });
+    auto presumed_loc = src_manager.getPresumedLoc(decl->getLocation());
+
+    // Find the start of the declaration and the end of its declarator, so that annotations can be
+    // added to it later, and so that it can be removed from flattened headers.
+    // The offsets are only meaningful if both ends are in the same file.
+    SourceLocation start_loc = src_manager.getExpansionLoc(decl->getSourceRange().getBegin());
+    SourceLocation end_loc = src_manager.getExpansionRange(decl->getSourceRange().getEnd()).second;
+    end_loc = Lexer::getLocForEndOfToken(end_loc, 0, src_manager, ctx.getLangOpts());
+    std::string offset_filename;
+    unsigned start_offset = 0;
+    unsigned end_offset = 0;
+    if (start_loc.isValid() && end_loc.isValid()) {
+      FileID file_id = src_manager.getFileID(end_loc);
+      const FileEntry* file_entry = src_manager.getFileEntryForID(file_id);
+      if (file_entry && src_manager.getFileID(start_loc) == file_id) {
+        offset_filename = file_entry->getName();
+        start_offset = src_manager.getFileOffset(start_loc);
+        end_offset = src_manager.getFileOffset(end_loc);
+      }
     }
 
-    auto& declaration_locations = declaration_it->second.locations;
-    auto presumed_loc = src_manager.getPresumedLoc(decl->getLocation());
+    uint64_t signature_hash = hashType(fnv_offset_basis, cast<ValueDecl>(decl)->getType());
+
     DeclarationLocation location = {
       .filename = presumed_loc.getFilename(),
       .line_number = presumed_loc.getLine(),
       .column = presumed_loc.getColumn(),
+      .offset_filename = std::move(offset_filename),
+      .start_offset = start_offset,
+      .end_offset = end_offset,
       .type = declaration_type,
       .is_extern = is_extern,
       .is_definition = is_definition,
       .availability = availability,
+      .signature_hash = signature_hash,
     };
 
-    // It's fine if the location is already there, we'll get an iterator to the existing element.
-    auto location_it = declaration_locations.begin();
-    bool inserted = false;
-    std::tie(location_it, inserted) = declaration_locations.insert(location);
-
-    // If we didn't insert, check to see if the availability attributes are identical.
-    if (!inserted) {
-      if (location_it->availability != availability) {
-        fprintf(stderr, "ERROR: availability attribute mismatch\n");
-        decl->dump();
-        abort();
-      }
-    }
-
+    // Duplicates are merged by HeaderDatabase::finalize.
+    database.pending.emplace_back(declaration_name, std::move(location));
     return true;
   }
 };
@@ -190,3 +301,194 @@ void HeaderDatabase::parseAST(ASTUnit* ast) {
   Visitor visitor(*this, ctx);
   visitor.TraverseDecl(ctx.getTranslationUnitDecl());
 }
+
+void HeaderDatabase::finalize() {
+  if (pending.empty()) {
+    return;
+  }
+
+  // Merge with anything that was finalized previously.
+  std::vector<Declaration> previous = std::move(declarations);
+  declarations.clear();
+  for (Declaration& declaration : previous) {
+    StringRef name = intern(declaration.name);
+    for (DeclarationLocation& location : declaration.locations) {
+      pending.emplace_back(name, std::move(location));
+    }
+  }
+
+  // Names are interned, so equal names have the same address.
+  std::sort(pending.begin(), pending.end(), [](const auto& lhs, const auto& rhs) {
+    if (lhs.first.data() != rhs.first.data()) {
+      return lhs.first < rhs.first;
+    }
+    return lhs.second < rhs.second;
+  });
+
+  const char* current_name = nullptr;
+  for (auto& it : pending) {
+    if (it.first.data() != current_name) {
+      current_name = it.first.data();
+      declarations.push_back({ .name = it.first.str() });
+    }
+
+    // The same location is seen once per header that includes it, and must always agree.
+    auto& locations = declarations.back().locations;
+    if (!locations.empty() && locations.back() == it.second) {
+      if (locations.back().availability != it.second.availability) {
+        fprintf(stderr, "ERROR: availability attribute mismatch for '%s' at %s:%u:%u\n",
+                declarations.back().name.c_str(), it.second.filename.c_str(),
+                it.second.line_number, it.second.column);
+        abort();
+      }
+      continue;
+    }
+    locations.push_back(std::move(it.second));
+  }
+
+  pending.clear();
+  pending.shrink_to_fit();
+  interned_names.clear();
+}
+
+const Declaration* HeaderDatabase::find(const std::string& name) const {
+  auto it = std::lower_bound(declarations.begin(), declarations.end(), name,
+                             [](const Declaration& declaration, const std::string& name) {
+                               return declaration.name < name;
+                             });
+  if (it == declarations.end() || it->name != name) {
+    return nullptr;
+  }
+  return &*it;
+}
+
+const DeclarationRange* SymbolDeclarations::findRange(const CompilationType& type) const {
+  // Find the last range that starts at or before type.
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), type,
+                             [](const CompilationType& type, const DeclarationRange& range) {
+                               return std::tie(type.arch, type.api_level) <
+                                      std::tie(range.arch, range.first_level);
+                             });
+  if (it == ranges.begin()) {
+    return nullptr;
+  }
+  --it;
+  return it->contains(type) ? &*it : nullptr;
+}
+
+const Declaration* SymbolDeclarations::first(const std::string& arch) const {
+  for (const DeclarationRange& range : ranges) {
+    if (range.arch == arch) {
+      return range.declaration.get();
+    }
+  }
+  return nullptr;
+}
+
+size_t DeclarationDatabase::DeclarationHash::operator()(
+  const std::shared_ptr<const Declaration>& declaration) const {
+  size_t result = std::hash<std::string>()(declaration->name);
+  auto combine = [&result](size_t value) {
+    result ^= value + 0x9e3779b9 + (result << 6) + (result >> 2);
+  };
+
+  for (const DeclarationLocation& location : declaration->locations) {
+    combine(std::hash<std::string>()(location.filename));
+    combine(location.line_number);
+    combine(location.column);
+    combine(location.availability.introduced);
+    combine(location.availability.obsoleted);
+    combine(location.signature_hash);
+  }
+  return result;
+}
+
+bool DeclarationDatabase::DeclarationEqual::operator()(
+  const std::shared_ptr<const Declaration>& lhs,
+  const std::shared_ptr<const Declaration>& rhs) const {
+  if (lhs->name != rhs->name || lhs->locations.size() != rhs->locations.size()) {
+    return false;
+  }
+  return std::equal(lhs->locations.begin(), lhs->locations.end(), rhs->locations.begin(),
+                    [](const DeclarationLocation& a, const DeclarationLocation& b) {
+                      return a.identical(b);
+                    });
+}
+
+void DeclarationDatabase::insert(const CompilationType& type, const Declaration& declaration) {
+  auto type_it = types.insert(type).first;
+
+  // Look the declaration up through a non-owning pointer to it (an alias of an empty shared_ptr),
+  // so that it's only copied if it isn't pooled already.
+  std::shared_ptr<const Declaration> key(std::shared_ptr<const Declaration>(), &declaration);
+  auto pool_it = pool.find(key);
+  if (pool_it == pool.end()) {
+    pool_it = pool.insert(std::make_shared<const Declaration>(declaration)).first;
+  }
+
+  std::vector<DeclarationRange>& ranges = symbols[declaration.name].ranges;
+
+  // The ranges on either side of the type.
+  auto next = std::upper_bound(ranges.begin(), ranges.end(), type,
+                               [](const CompilationType& type, const DeclarationRange& range) {
+                                 return std::tie(type.arch, type.api_level) <
+                                        std::tie(range.arch, range.first_level);
+                               });
+  DeclarationRange* previous = next == ranges.begin() ? nullptr : &*std::prev(next);
+  if (previous && previous->contains(type)) {
+    errx(1, "declaration of %s for %s inserted twice", declaration.name.c_str(),
+         type.describe().c_str());
+  }
+
+  // Join the ranges that end at the previous compiled level of the same arch, and start at the
+  // next one, if they have the same declaration.
+  auto previous_type = type_it == types.begin() ? types.end() : std::prev(type_it);
+  auto next_type = std::next(type_it);
+  bool extend_previous = previous && previous->arch == type.arch &&
+                         previous->declaration == *pool_it && previous_type != types.end() &&
+                         previous_type->arch == type.arch &&
+                         previous_type->api_level == previous->last_level;
+  bool extend_next = next != ranges.end() && next->arch == type.arch &&
+                     next->declaration == *pool_it && next_type != types.end() &&
+                     next_type->arch == type.arch && next_type->api_level == next->first_level;
+
+  if (extend_previous && extend_next) {
+    previous->last_level = next->last_level;
+    ranges.erase(next);
+    --range_count;
+  } else if (extend_previous) {
+    previous->last_level = type.api_level;
+  } else if (extend_next) {
+    next->first_level = type.api_level;
+  } else {
+    ranges.insert(next, {
+      .arch = type.arch,
+      .first_level = type.api_level,
+      .last_level = type.api_level,
+      .declaration = *pool_it,
+    });
+    ++range_count;
+  }
+}
+
+const Declaration* DeclarationDatabase::find(const std::string& symbol,
+                                             const CompilationType& type) const {
+  if (types.count(type) == 0) {
+    return nullptr;
+  }
+
+  auto it = symbols.find(symbol);
+  if (it == symbols.end()) {
+    return nullptr;
+  }
+  return it->second.find(type);
+}
+
+std::vector<CompilationType> DeclarationDatabase::expand(const DeclarationRange& range) const {
+  std::vector<CompilationType> result;
+  CompilationType first = { .arch = range.arch, .api_level = range.first_level };
+  for (auto it = types.lower_bound(first); it != types.end() && range.contains(*it); ++it) {
+    result.push_back(*it);
+  }
+  return result;
+}
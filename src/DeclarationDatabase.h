@@ -28,12 +28,21 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <iostream>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+
 #include "Utils.h"
 
 enum class DeclarationType {
@@ -53,13 +62,19 @@ static const char* declarationTypeName(DeclarationType type) {
   }
 }
 
+enum class CompilationLanguage : uint8_t {
+  c,
+  cxx,
+};
+
 struct CompilationType {
   std::string arch;
   int api_level;
+  CompilationLanguage language = CompilationLanguage::c;
 
  private:
   auto tie() const {
-    return std::make_tuple(arch, api_level);
+    return std::make_tuple(arch, api_level, language);
   }
 
  public:
@@ -71,8 +86,19 @@ struct CompilationType {
     return tie() == other.tie();
   }
 
+  // The same type, compiled as the other language.
+  CompilationType as(CompilationLanguage other_language) const {
+    CompilationType result = *this;
+    result.language = other_language;
+    return result;
+  }
+
   std::string describe() const {
-    return arch + "-" + std::to_string(api_level);
+    std::string result = arch + "-" + std::to_string(api_level);
+    if (language == CompilationLanguage::cxx) {
+      result += "-c++";
+    }
+    return result;
   }
 };
 
@@ -81,28 +107,31 @@ struct DeclarationAvailability {
   int deprecated = 0;
   int obsoleted = 0;
 
-  void dump(std::ostream& out = std::cout) const {
+  // Append a description of the non-zero fields (e.g. "introduced = 21, obsoleted = 23").
+  void appendDescription(std::string* out) const {
     bool need_comma = false;
-    auto comma = [&out, &need_comma]() {
-      if (!need_comma) {
-        need_comma = true;
+    auto append = [out, &need_comma](const char* field, int value) {
+      if (value == 0) {
         return;
       }
-      out << ", ";
+      if (need_comma) {
+        out->append(", ");
+      }
+      need_comma = true;
+      out->append(field);
+      out->append(" = ");
+      out->append(std::to_string(value));
     };
 
-    if (introduced != 0) {
-      comma();
-      out << "introduced = " << introduced;
-    }
-    if (deprecated != 0) {
-      comma();
-      out << "deprecated = " << deprecated;
-    }
-    if (obsoleted != 0) {
-      comma();
-      out << "obsoleted = " << obsoleted;
-    }
+    append("introduced", introduced);
+    append("deprecated", deprecated);
+    append("obsoleted", obsoleted);
+  }
+
+  void dump(std::ostream& out = std::cout) const {
+    std::string description;
+    appendDescription(&description);
+    out << description;
   }
 
   bool empty() const {
@@ -131,11 +160,23 @@ struct DeclarationLocation {
   std::string filename;
   unsigned line_number;
   unsigned column;
+
+  // Offsets of the start of the declaration and the end of its declarator, into offset_filename:
+  // the file that the declaration was expanded in, which isn't filename under a #line directive.
+  // The end is 0 if unknown.
+  std::string offset_filename;
+  unsigned start_offset;
+  unsigned end_offset;
+
   DeclarationType type;
   bool is_extern;
   bool is_definition;
   DeclarationAvailability availability;
 
+  // A hash of the declaration's type as written (with typedef names intact), so that prototypes
+  // that differ between architectures or API levels can be found by comparing integers.
+  uint64_t signature_hash;
+
   auto tie() const {
     return std::tie(filename, line_number, column, type, is_extern, is_definition);
   }
@@ -147,11 +188,20 @@ struct DeclarationLocation {
   bool operator==(const DeclarationLocation& other) const {
     return tie() == other.tie();
   }
+
+  // Unlike operator==, also compare the fields that don't identify the location.
+  bool identical(const DeclarationLocation& other) const {
+    return *this == other && offset_filename == other.offset_filename &&
+           start_offset == other.start_offset && end_offset == other.end_offset &&
+           availability == other.availability && signature_hash == other.signature_hash;
+  }
 };
 
 struct Declaration {
   std::string name;
-  std::set<DeclarationLocation> locations;
+
+  // Sorted and unique. Almost every declaration has only one or two locations.
+  llvm::SmallVector<DeclarationLocation, 2> locations;
 
   bool hasDefinition() const {
     for (const auto& location : locations) {
@@ -162,6 +212,28 @@ struct Declaration {
     return false;
   }
 
+  // Whether a program using the declaration at an API level needs a library to export the
+  // symbol. Inline definitions don't, and neither do declarations that aren't available yet.
+  bool needsLinking(int api_level) const {
+    if (hasDefinition()) {
+      return false;
+    }
+
+    const DeclarationAvailability& availability = locations.begin()->availability;
+    if (availability.introduced != 0 && api_level < availability.introduced) {
+      return false;
+    } else if (availability.obsoleted != 0 && api_level >= availability.obsoleted) {
+      return false;
+    }
+
+    for (const DeclarationLocation& location : locations) {
+      if (location.is_extern) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   DeclarationType type() const {
     DeclarationType result = locations.begin()->type;
     for (const DeclarationLocation& location : locations) {
@@ -172,33 +244,170 @@ struct Declaration {
     return result;
   }
 
-  void dump(const std::string& base_path = "", std::ostream& out = std::cout) const {
-    out << "    " << name << " declared in " << locations.size() << " locations:\n";
+  // Append a human-readable description of all of the locations of the declaration.
+  void appendDescription(std::string* out, const std::string& base_path = "") const {
+    out->append("    " + name + " declared in " + std::to_string(locations.size()) +
+                " locations:\n");
     for (const DeclarationLocation& location : locations) {
       const char* var_type = declarationTypeName(location.type);
       const char* declaration_type = location.is_definition ? "definition" : "declaration";
       const char* linkage = location.is_extern ? "extern" : "static";
 
-      std::string filename;
+      out->append("        ");
+      out->append(linkage);
+      out->append(" ");
+      out->append(var_type);
+      out->append(" ");
+      out->append(declaration_type);
+      out->append(" @ ");
       if (StartsWith(location.filename, base_path)) {
-        filename = location.filename.substr(base_path.length());
+        out->append(location.filename, base_path.length(), std::string::npos);
       } else {
-        filename = location.filename;
+        out->append(location.filename);
       }
-
-      out << "        " << linkage << " " << var_type << " " << declaration_type << " @ "
-          << filename << ":" << location.line_number << ":" << location.column;
+      out->append(":" + std::to_string(location.line_number) + ":" +
+                  std::to_string(location.column));
 
       if (!location.availability.empty()) {
-        out << "\t[";
-        location.availability.dump(out);
-        out << "]";
+        out->append("\t[");
+        location.availability.appendDescription(out);
+        out->append("]");
       } else {
-        out << "\t[no availability]";
+        out->append("\t[no availability]");
       }
 
-      out << "\n";
+      out->append("\n");
+    }
+  }
+
+  void dump(const std::string& base_path = "", std::ostream& out = std::cout) const {
+    std::string description;
+    appendDescription(&description, base_path);
+    out << description;
+  }
+};
+
+// A run of consecutive compiled API levels of one architecture at which a symbol's declarations
+// are identical.
+struct DeclarationRange {
+  std::string arch;
+  int first_level;
+  int last_level;
+  std::shared_ptr<const Declaration> declaration;
+
+  bool contains(const CompilationType& type) const {
+    return type.arch == arch && type.api_level >= first_level && type.api_level <= last_level;
+  }
+
+  std::string describe() const {
+    std::string result = arch + "-" + std::to_string(first_level);
+    if (last_level != first_level) {
+      result += ".." + std::to_string(last_level);
     }
+    return result;
+  }
+};
+
+// The declarations of a single symbol, as ranges ordered by architecture and then API level.
+class SymbolDeclarations {
+  friend class DeclarationDatabase;
+  std::vector<DeclarationRange> ranges;
+
+ public:
+  const std::vector<DeclarationRange>& getRanges() const {
+    return ranges;
+  }
+
+  // Find the range that a CompilationType falls into, or nullptr if the symbol isn't declared in
+  // it. Only meaningful for types that were actually compiled.
+  const DeclarationRange* findRange(const CompilationType& type) const;
+
+  const Declaration* find(const CompilationType& type) const {
+    const DeclarationRange* range = findRange(type);
+    return range ? range->declaration.get() : nullptr;
+  }
+
+  // The declaration at the lowest API level of an architecture, or nullptr.
+  const Declaration* first(const std::string& arch) const;
+};
+
+// Map from symbol name to the declarations of that symbol in each CompilationType.
+//
+// Most symbols are declared identically at every API level (and often on every architecture), so
+// each distinct Declaration is stored once and shared, and each symbol maps runs of consecutive
+// levels to it, rather than storing a copy per CompilationType. Ranges don't record a language, so
+// C and C++ compilations are kept in separate databases.
+class DeclarationDatabase {
+  struct DeclarationHash {
+    size_t operator()(const std::shared_ptr<const Declaration>& declaration) const;
+  };
+
+  struct DeclarationEqual {
+    bool operator()(const std::shared_ptr<const Declaration>& lhs,
+                    const std::shared_ptr<const Declaration>& rhs) const;
+  };
+
+  std::set<CompilationType> types;
+  std::unordered_set<std::shared_ptr<const Declaration>, DeclarationHash, DeclarationEqual> pool;
+  std::map<std::string, SymbolDeclarations> symbols;
+  size_t range_count = 0;
+
+ public:
+  using const_iterator = std::map<std::string, SymbolDeclarations>::const_iterator;
+
+  DeclarationDatabase() = default;
+  explicit DeclarationDatabase(std::set<CompilationType> types) : types(std::move(types)) {
+  }
+
+  // Add the declaration of a symbol in a CompilationType. If the database was constructed with
+  // every type that will be inserted, types can be inserted in any order (e.g. as their
+  // compilations finish). Otherwise, each symbol's declarations must be inserted in increasing
+  // order of CompilationType.
+  void insert(const CompilationType& type, const Declaration& declaration);
+
+  // Find the declaration of a symbol in a CompilationType, or nullptr.
+  const Declaration* find(const std::string& symbol, const CompilationType& type) const;
+
+  const_iterator find(const std::string& symbol) const {
+    return symbols.find(symbol);
+  }
+
+  const_iterator begin() const {
+    return symbols.begin();
+  }
+
+  const_iterator end() const {
+    return symbols.end();
+  }
+
+  size_t size() const {
+    return symbols.size();
+  }
+
+  bool empty() const {
+    return symbols.empty();
+  }
+
+  void clear() {
+    types.clear();
+    pool.clear();
+    symbols.clear();
+    range_count = 0;
+  }
+
+  const std::set<CompilationType>& compilationTypes() const {
+    return types;
+  }
+
+  // The compiled CompilationTypes that a range covers.
+  std::vector<CompilationType> expand(const DeclarationRange& range) const;
+
+  size_t rangeCount() const {
+    return range_count;
+  }
+
+  size_t distinctDeclarationCount() const {
+    return pool.size();
   }
 };
 
@@ -207,15 +416,42 @@ class ASTUnit;
 }
 
 class HeaderDatabase {
+  friend class Visitor;
+
+  // Pairs of (symbol name, location) collected by parseAST, in the order they were visited.
+  // The names point into interned_names.
+  std::vector<std::pair<llvm::StringRef, DeclarationLocation>> pending;
+  llvm::StringSet<> interned_names;
+
+  llvm::StringRef intern(llvm::StringRef name) {
+    return interned_names.insert(name).first->getKey();
+  }
+
  public:
-  std::map<std::string, Declaration> declarations;
+  struct Stats {
+    // Names that had to be mangled, and redeclarations whose mangled name was reused instead.
+    size_t mangled_names = 0;
+    size_t mangles_avoided = 0;
+  };
+
+  Stats stats;
+
+  // Sorted by name. Only up to date after finalize.
+  std::vector<Declaration> declarations;
 
   void parseAST(clang::ASTUnit* ast);
 
+  // Sort and deduplicate everything collected by parseAST into declarations.
+  void finalize();
+
+  const Declaration* find(const std::string& name) const;
+
   void dump(const std::string& base_path = "", std::ostream& out = std::cout) const {
-    out << "HeaderDatabase contains " << declarations.size() << " declarations:\n";
-    for (const auto& pair : declarations) {
-      pair.second.dump(base_path, out);
+    std::string description =
+      "HeaderDatabase contains " + std::to_string(declarations.size()) + " declarations:\n";
+    for (const Declaration& declaration : declarations) {
+      declaration.appendDescription(&description, base_path);
     }
+    out << description;
   }
 };
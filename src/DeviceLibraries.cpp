@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "DeviceLibraries.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Diagnostics.h"
+#include "FileCache.h"
+#include "Metrics.h"
+#include "SymbolDatabase.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace std::string_literals;
+
+static const std::set<std::string> device_libraries = { "libc.so", "libdl.so", "libm.so" };
+
+// Collect the API levels of the android-N directories in a directory.
+static std::set<int> collectLevels(const std::string& arch_dir) {
+  std::set<int> result;
+  DIR* dir = opendir(arch_dir.c_str());
+  if (!dir) {
+    return result;
+  }
+
+  struct dirent* dent;
+  while ((dent = readdir(dir))) {
+    std::string name = dent->d_name;
+    if (!StartsWith(name, "android-")) {
+      continue;
+    }
+
+    char* end;
+    const char* level = name.c_str() + strlen("android-");
+    int api_level = strtol(level, &end, 10);
+    if (end == level || *end != '\0') {
+      continue;
+    }
+    result.insert(api_level);
+  }
+
+  closedir(dir);
+  return result;
+}
+
+DeviceLibraryDatabase parseDeviceLibraries(const std::set<std::string>& archs,
+                                           const std::string& library_dir) {
+  PhaseTimer phase_timer("device_libraries");
+  DeviceLibraryDatabase result;
+
+  struct Job {
+    std::string arch;
+    int api_level;
+    std::string path;
+  };
+
+  std::vector<Job> jobs;
+  for (const std::string& arch : archs) {
+    std::string arch_dir = library_dir + "/" + arch;
+    std::set<int> levels = collectLevels(arch_dir);
+    if (levels.empty()) {
+      continue;
+    }
+
+    result.levels[arch] = levels;
+    for (int api_level : levels) {
+      for (const std::string& library : device_libraries) {
+        std::string path = arch_dir + "/android-" + std::to_string(api_level) + "/" + library;
+        jobs.push_back({ .arch = arch, .api_level = api_level, .path = path });
+      }
+    }
+  }
+
+  if (result.levels.empty()) {
+    errx(1, "no device libraries found in '%s'", library_dir.c_str());
+  }
+
+  std::vector<std::string> manifest;
+  for (const Job& job : jobs) {
+    manifest.push_back(job.path);
+  }
+  file_cache.prefetch(manifest);
+
+  for (const Job& job : jobs) {
+    if (file_cache.isMissing(job.path)) {
+      errx(1, "missing device library '%s'", job.path.c_str());
+    }
+  }
+
+  std::mutex mutex;
+  ParallelFor(jobs.size(), [&](size_t i) {
+    const Job& job = jobs[i];
+    LibrarySymbolTable symbols = getSymbolTable(job.path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& it : symbols) {
+      if (it.second.is_private) {
+        continue;
+      }
+
+      result.symbols[it.first][job.arch].insert(job.api_level);
+      if (it.second.version_level != 0) {
+        int& version_level = result.version_levels[it.first];
+        version_level = std::max(version_level, it.second.version_level);
+      }
+    }
+  });
+
+  return result;
+}
+
+static Diagnostic makeDiagnostic(DiagnosticCode code, DiagnosticSeverity severity,
+                                 const std::string& symbol, const std::string& message) {
+  Diagnostic result;
+  result.code = code;
+  result.severity = severity;
+  result.symbol = symbol;
+  result.message = message;
+  return result;
+}
+
+bool checkDeviceLibraries(const std::set<CompilationType>& types,
+                          const DeclarationDatabase& declaration_database,
+                          const DeviceLibraryDatabase& device_database, DiagnosticSink& sink) {
+  bool failed = false;
+
+  std::set<std::string> selected_archs;
+  for (const CompilationType& type : types) {
+    selected_archs.insert(type.arch);
+  }
+
+  for (const auto& outer : declaration_database) {
+    const std::string& symbol_name = outer.first;
+    const SymbolDeclarations& declarations = outer.second;
+
+    auto symbol_it = device_database.symbols.find(symbol_name);
+    auto version_it = device_database.version_levels.find(symbol_name);
+    int version_level = version_it == device_database.version_levels.end() ? 0 : version_it->second;
+
+    for (const auto& arch_levels : device_database.levels) {
+      const std::string& arch = arch_levels.first;
+      if (selected_archs.count(arch) == 0) {
+        continue;
+      }
+      int min_api = archMinApi(arch);
+
+      // Use the first declaration for the arch, as checkVersions does.
+      const Declaration* declaration = declarations.first(arch);
+
+      // Inline definitions don't need to be exported.
+      if (!declaration || declaration->hasDefinition()) {
+        continue;
+      }
+
+      const DeclarationAvailability& availability = declaration->locations.begin()->availability;
+
+      static const std::set<int> empty;
+      const std::set<int>* present = &empty;
+      if (symbol_it != device_database.symbols.end()) {
+        auto arch_it = symbol_it->second.find(arch);
+        if (arch_it != symbol_it->second.end()) {
+          present = &arch_it->second;
+        }
+      }
+
+      if (present->empty()) {
+        if (verbose) {
+          sink.report(makeDiagnostic(
+            DiagnosticCode::not_on_device, DiagnosticSeverity::note, symbol_name,
+            "not exported by any " + arch + " device library"));
+        }
+        continue;
+      }
+
+      int first_level = *present->begin();
+      std::vector<CompilationType> missing;
+      std::vector<int> removed;
+      for (int api_level : arch_levels.second) {
+        if (api_level > first_level && present->count(api_level) == 0) {
+          removed.push_back(api_level);
+        }
+
+        if (api_level < min_api) {
+          continue;
+        } else if (availability.introduced != 0 && api_level < availability.introduced) {
+          continue;
+        } else if (availability.obsoleted != 0 && api_level >= availability.obsoleted) {
+          continue;
+        }
+
+        if (present->count(api_level) == 0) {
+          CompilationType type = { .arch = arch, .api_level = api_level };
+          missing.push_back(type);
+        }
+      }
+
+      if (!missing.empty()) {
+        std::vector<std::string> missing_types;
+        for (const CompilationType& type : missing) {
+          missing_types.push_back(type.describe());
+        }
+
+        Diagnostic diagnostic = makeDiagnostic(
+          DiagnosticCode::missing_on_device, DiagnosticSeverity::error, symbol_name,
+          "declared available as " + availability.describe() +
+            ", but not exported by device libraries in [" + Join(missing_types) + "]");
+        diagnostic.types = std::move(missing);
+        diagnostic.declarations = { *declaration };
+        sink.report(std::move(diagnostic));
+        failed = true;
+      }
+
+      // Symbols in a versioned node (e.g. LIBC_N) were added in that release, even if we don't
+      // have the device libraries to show it.
+      if (missing.empty() && version_level > min_api && first_level >= version_level &&
+          availability.introduced < version_level) {
+        Diagnostic diagnostic = makeDiagnostic(
+          DiagnosticCode::symbol_version_mismatch, DiagnosticSeverity::error, symbol_name,
+          "exported with a symbol version from API level " + std::to_string(version_level) +
+            ", but declared as " + availability.describe());
+        diagnostic.declarations = { *declaration };
+        sink.report(std::move(diagnostic));
+        failed = true;
+      }
+
+      if (verbose) {
+        if (first_level < availability.introduced) {
+          sink.report(makeDiagnostic(
+            DiagnosticCode::exported_before_introduction, DiagnosticSeverity::note, symbol_name,
+            "exported on " + arch + " since android-" + std::to_string(first_level) +
+              ", but declared as introduced in " + std::to_string(availability.introduced)));
+        }
+        if (!removed.empty()) {
+          sink.report(makeDiagnostic(
+            DiagnosticCode::removed_on_device, DiagnosticSeverity::note, symbol_name,
+            "removed from " + arch + " device libraries in [" + Join(removed) + "]"));
+        }
+      }
+    }
+  }
+
+  return !failed;
+}
+
+// A difference between the stub and device libraries: the symbol, and what's wrong with it.
+using DriftEntry = std::pair<std::string, std::string>;
+
+struct LibraryDrift {
+  std::vector<DriftEntry> missing;
+  std::vector<DriftEntry> type_mismatches;
+  std::vector<DriftEntry> size_mismatches;
+  size_t device_only = 0;
+};
+
+static LibraryDrift compareLibraries(const std::string& stub_path, const std::string& device_path) {
+  LibraryDrift result;
+  LibrarySymbolTable stub_symbols = getSymbolTable(stub_path);
+  LibrarySymbolTable device_symbols = getSymbolTable(device_path);
+
+  for (const auto& it : stub_symbols) {
+    const std::string& symbol_name = it.first;
+    const LibrarySymbol& stub_symbol = it.second;
+
+    auto device_it = device_symbols.find(symbol_name);
+    if (device_it == device_symbols.end()) {
+      result.missing.emplace_back(symbol_name, "exported by stub, missing on device");
+      continue;
+    }
+
+    const LibrarySymbol& device_symbol = device_it->second;
+    if (device_symbol.is_private) {
+      result.missing.emplace_back(symbol_name, "exported by stub, private on device");
+    } else if (stub_symbol.type != device_symbol.type) {
+      result.type_mismatches.emplace_back(symbol_name, ndkSymbolTypeName(stub_symbol.type) +
+                                                         " in stub, "s +
+                                                         ndkSymbolTypeName(device_symbol.type) +
+                                                         " on device");
+    } else if (stub_symbol.type == NdkSymbolType::variable &&
+               stub_symbol.size != device_symbol.size) {
+      result.size_mismatches.emplace_back(symbol_name, std::to_string(stub_symbol.size) +
+                                                         " bytes in stub, " +
+                                                         std::to_string(device_symbol.size) +
+                                                         " bytes on device");
+    }
+  }
+
+  for (const auto& it : device_symbols) {
+    if (stub_symbols.count(it.first) == 0) {
+      ++result.device_only;
+    }
+  }
+
+  std::sort(result.missing.begin(), result.missing.end());
+  std::sort(result.type_mismatches.begin(), result.type_mismatches.end());
+  std::sort(result.size_mismatches.begin(), result.size_mismatches.end());
+  return result;
+}
+
+// Get the directory of the stub libraries of an NDK platform level, which is usr/lib64 for 64-bit
+// architectures that have one, and usr/lib otherwise.
+static std::string stubLibraryDir(const std::string& stub_dir, const std::string& arch,
+                                  int stub_level) {
+  std::string result =
+    stub_dir + "/" + arch + "/android-" + std::to_string(stub_level) + "/usr/lib64";
+  if (access(result.c_str(), F_OK) != 0) {
+    result = result.substr(0, result.length() - strlen("64"));
+  }
+  return result;
+}
+
+bool checkLibraryDrift(const std::set<std::string>& archs, const std::string& stub_dir,
+                       const std::string& library_dir, DiagnosticSink& sink) {
+  struct Job {
+    std::string arch;
+    int device_level;
+    int stub_level;
+    std::string library;
+    std::string stub_path;
+    std::string device_path;
+  };
+
+  std::vector<Job> candidates;
+  for (const std::string& arch : archs) {
+    std::set<int> device_levels = collectLevels(library_dir + "/" + arch);
+    std::set<int> stub_levels = collectLevels(stub_dir + "/" + arch);
+
+    for (int device_level : device_levels) {
+      // Devices need to provide everything in the newest NDK platform that isn't newer than them.
+      auto stub_it = stub_levels.upper_bound(device_level);
+      if (stub_it == stub_levels.begin()) {
+        continue;
+      }
+      int stub_level = *--stub_it;
+
+      std::string stub_lib_dir = stubLibraryDir(stub_dir, arch, stub_level);
+
+      for (const std::string& library : device_libraries) {
+        Job job = {
+          .arch = arch,
+          .device_level = device_level,
+          .stub_level = stub_level,
+          .library = library,
+          .stub_path = stub_lib_dir + "/" + library,
+          .device_path = library_dir + "/" + arch + "/android-" + std::to_string(device_level) +
+                         "/" + library,
+        };
+
+        candidates.push_back(job);
+      }
+    }
+  }
+
+  std::vector<std::string> manifest;
+  for (const Job& job : candidates) {
+    manifest.push_back(job.stub_path);
+    manifest.push_back(job.device_path);
+  }
+  file_cache.prefetch(manifest);
+
+  std::vector<Job> jobs;
+  for (const Job& job : candidates) {
+    if (!file_cache.isMissing(job.stub_path) && !file_cache.isMissing(job.device_path)) {
+      jobs.push_back(job);
+    }
+  }
+
+  if (jobs.empty()) {
+    errx(1, "no matching libraries found in '%s' and '%s'", stub_dir.c_str(),
+         library_dir.c_str());
+  }
+
+  std::vector<LibraryDrift> results(jobs.size());
+  ParallelFor(jobs.size(), [&](size_t i) {
+    results[i] = compareLibraries(jobs[i].stub_path, jobs[i].device_path);
+  });
+
+  bool failed = false;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    const Job& job = jobs[i];
+    const LibraryDrift& drift = results[i];
+    CompilationType type = { .arch = job.arch, .api_level = job.device_level };
+
+    std::string where = type.describe() + " " + job.library;
+
+    Diagnostic summary = makeDiagnostic(
+      DiagnosticCode::library_drift_summary, DiagnosticSeverity::note, "",
+      where + " (stub from android-" + std::to_string(job.stub_level) + "): " +
+        std::to_string(drift.missing.size()) + " missing, " +
+        std::to_string(drift.type_mismatches.size()) + " type mismatches, " +
+        std::to_string(drift.size_mismatches.size()) + " size mismatches, " +
+        std::to_string(drift.device_only) + " only on device");
+    summary.types = { type };
+    sink.report(std::move(summary));
+
+    auto report = [&](DiagnosticCode code, DiagnosticSeverity severity, const DriftEntry& entry) {
+      Diagnostic diagnostic =
+        makeDiagnostic(code, severity, entry.first, entry.second + " (" + where + ")");
+      diagnostic.types = { type };
+      sink.report(std::move(diagnostic));
+    };
+
+    for (const DriftEntry& entry : drift.missing) {
+      report(DiagnosticCode::stub_symbol_missing_on_device, DiagnosticSeverity::error, entry);
+    }
+
+    for (const DriftEntry& entry : drift.type_mismatches) {
+      report(DiagnosticCode::stub_type_mismatch, DiagnosticSeverity::error, entry);
+    }
+
+    // Stubs don't necessarily have accurate sizes for their variables, so only complain if asked.
+    if (verbose) {
+      for (const DriftEntry& entry : drift.size_mismatches) {
+        report(DiagnosticCode::stub_size_mismatch, DiagnosticSeverity::warning, entry);
+      }
+    }
+
+    failed |= !drift.missing.empty() || !drift.type_mismatches.empty();
+  }
+
+  return !failed;
+}
+
+// Collect the shared libraries in a directory.
+static std::vector<std::string> collectLibraries(const std::string& lib_dir) {
+  std::vector<std::string> result;
+  DIR* dir = opendir(lib_dir.c_str());
+  if (!dir) {
+    return result;
+  }
+
+  struct dirent* dent;
+  while ((dent = readdir(dir))) {
+    std::string name = dent->d_name;
+    if (EndsWith(name, ".so")) {
+      result.push_back(lib_dir + "/" + name);
+    }
+  }
+
+  closedir(dir);
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+bool checkStubLinkage(const std::set<CompilationType>& types,
+                      const DeclarationDatabase& declaration_database, const std::string& stub_dir,
+                      DiagnosticSink& sink) {
+  // Each type links against the newest stubs that aren't newer than it.
+  std::map<std::string, std::set<int>> arch_stub_levels;
+  std::vector<CompilationType> linked_types;
+  std::vector<std::pair<std::string, int>> stub_sets;
+  std::vector<size_t> type_stub_sets;
+  for (const CompilationType& type : types) {
+    auto levels_it = arch_stub_levels.find(type.arch);
+    if (levels_it == arch_stub_levels.end()) {
+      levels_it = arch_stub_levels.emplace(type.arch, collectLevels(stub_dir + "/" + type.arch))
+                    .first;
+    }
+
+    auto stub_it = levels_it->second.upper_bound(type.api_level);
+    if (stub_it == levels_it->second.begin()) {
+      continue;
+    }
+
+    std::pair<std::string, int> stub_set(type.arch, *--stub_it);
+    if (stub_sets.empty() || stub_sets.back() != stub_set) {
+      stub_sets.push_back(stub_set);
+    }
+    linked_types.push_back(type);
+    type_stub_sets.push_back(stub_sets.size() - 1);
+  }
+
+  if (linked_types.empty()) {
+    errx(1, "no stub libraries found in '%s'", stub_dir.c_str());
+  }
+
+  // Index the symbols exported by each set of stubs, reading all of the libraries up front.
+  std::vector<std::vector<std::string>> stub_libraries;
+  std::vector<std::string> manifest;
+  for (const auto& stub_set : stub_sets) {
+    stub_libraries.push_back(
+      collectLibraries(stubLibraryDir(stub_dir, stub_set.first, stub_set.second)));
+    manifest.insert(manifest.end(), stub_libraries.back().begin(), stub_libraries.back().end());
+  }
+  file_cache.prefetch(manifest);
+
+  std::vector<LibrarySymbolDatabase> stub_exports(stub_sets.size());
+  ParallelFor(stub_sets.size(), [&](size_t i) {
+    for (const std::string& library : stub_libraries[i]) {
+      LibrarySymbolDatabase symbols = getSymbols(library);
+      stub_exports[i].insert(symbols.begin(), symbols.end());
+    }
+  });
+
+  // Resolve all of the declarations of each type against its stubs in one pass.
+  std::vector<std::vector<const std::string*>> unresolved(linked_types.size());
+  ParallelFor(linked_types.size(), [&](size_t i) {
+    const CompilationType& type = linked_types[i];
+    const LibrarySymbolDatabase& exports = stub_exports[type_stub_sets[i]];
+    for (const auto& it : declaration_database) {
+      const Declaration* declaration = it.second.find(type);
+      if (declaration && declaration->needsLinking(type.api_level) &&
+          exports.count(it.first) == 0) {
+        unresolved[i].push_back(&it.first);
+      }
+    }
+  });
+
+  // Report each symbol once, with every type that it would fail to link in.
+  std::map<std::string, std::vector<CompilationType>> failures;
+  for (size_t i = 0; i < linked_types.size(); ++i) {
+    for (const std::string* symbol_name : unresolved[i]) {
+      failures[*symbol_name].push_back(linked_types[i]);
+    }
+  }
+
+  for (auto& it : failures) {
+    std::vector<std::string> failed_types;
+    for (const CompilationType& type : it.second) {
+      failed_types.push_back(type.describe());
+    }
+
+    Diagnostic diagnostic =
+      makeDiagnostic(DiagnosticCode::unresolved_in_stub, DiagnosticSeverity::error, it.first,
+                     "declared available, but would fail to link against the NDK stub "
+                     "libraries in [" + Join(failed_types) + "]");
+    diagnostic.declarations = { *declaration_database.find(it.first, it.second[0]) };
+    diagnostic.types = std::move(it.second);
+    sink.report(std::move(diagnostic));
+  }
+
+  return failures.empty();
+}
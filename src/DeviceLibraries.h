@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "DeclarationDatabase.h"
+#include "Diagnostics.h"
+
+// Symbols exported by the libraries of real devices, laid out as
+// LIBRARY_PATH/<arch>/android-<level>/{libc,libdl,libm}.so.
+struct DeviceLibraryDatabase {
+  // Map from arch to the API levels that there are libraries for.
+  std::map<std::string, std::set<int>> levels;
+
+  // Map from symbol name to a map from arch to the API levels at which it's publicly exported.
+  std::map<std::string, std::map<std::string, std::set<int>>> symbols;
+
+  // Map from symbol name to the API level implied by its symbol version (e.g. 24 for LIBC_N).
+  std::map<std::string, int> version_levels;
+};
+
+DeviceLibraryDatabase parseDeviceLibraries(const std::set<std::string>& archs,
+                                           const std::string& library_dir);
+
+// Check that every declared symbol is actually exported by the device libraries at every level
+// it's declared available at.
+bool checkDeviceLibraries(const std::set<CompilationType>& types,
+                          const DeclarationDatabase& declaration_database,
+                          const DeviceLibraryDatabase& device_database, DiagnosticSink& sink);
+
+// Check that every declared extern symbol would resolve against the NDK stub libraries at
+// STUB_PATH/<arch>/android-<level>/usr/lib{,64}/*.so, linking each type against the newest stubs
+// that aren't newer than it.
+bool checkStubLinkage(const std::set<CompilationType>& types,
+                      const DeclarationDatabase& declaration_database, const std::string& stub_dir,
+                      DiagnosticSink& sink);
+
+// Compare the NDK stub libraries at STUB_PATH/<arch>/android-<level>/usr/lib{,64} against the
+// device libraries of the same or newer levels, reporting symbols that the stubs export but the
+// devices don't, and differences in symbol type or object size.
+bool checkLibraryDrift(const std::set<std::string>& archs, const std::string& stub_dir,
+                       const std::string& library_dir, DiagnosticSink& sink);
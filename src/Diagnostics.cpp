@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Diagnostics.h"
+
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <utility>
+
+static constexpr size_t diagnostic_buffer_size = 64 * 1024;
+
+const char* diagnosticCodeName(DiagnosticCode code) {
+  switch (code) {
+    case DiagnosticCode::inconsistent_declarations:
+      return "inconsistent-declarations";
+    case DiagnosticCode::inconsistent_across_levels:
+      return "inconsistent-across-levels";
+    case DiagnosticCode::not_in_any_platform:
+      return "not-in-any-platform";
+    case DiagnosticCode::missing_declaration:
+      return "missing-declaration";
+    case DiagnosticCode::symbol_type_mismatch:
+      return "symbol-type-mismatch";
+    case DiagnosticCode::missing_symbol:
+      return "missing-symbol";
+    case DiagnosticCode::undeclared_availability:
+      return "undeclared-availability";
+    case DiagnosticCode::not_on_device:
+      return "not-on-device";
+    case DiagnosticCode::missing_on_device:
+      return "missing-on-device";
+    case DiagnosticCode::symbol_version_mismatch:
+      return "symbol-version-mismatch";
+    case DiagnosticCode::exported_before_introduction:
+      return "exported-before-introduction";
+    case DiagnosticCode::removed_on_device:
+      return "removed-on-device";
+    case DiagnosticCode::library_drift_summary:
+      return "library-drift-summary";
+    case DiagnosticCode::stub_symbol_missing_on_device:
+      return "stub-symbol-missing-on-device";
+    case DiagnosticCode::stub_type_mismatch:
+      return "stub-type-mismatch";
+    case DiagnosticCode::stub_size_mismatch:
+      return "stub-size-mismatch";
+    case DiagnosticCode::availability_added:
+      return "availability-added";
+    case DiagnosticCode::availability_removed:
+      return "availability-removed";
+    case DiagnosticCode::availability_changed:
+      return "availability-changed";
+    case DiagnosticCode::unresolved_in_stub:
+      return "unresolved-in-stub";
+    case DiagnosticCode::signature_mismatch:
+      return "signature-mismatch";
+    case DiagnosticCode::cxx_linkage_mismatch:
+      return "cxx-linkage-mismatch";
+    case DiagnosticCode::cxx_availability_mismatch:
+      return "cxx-availability-mismatch";
+    case DiagnosticCode::unlocatable_declaration:
+      return "unlocatable-declaration";
+    case DiagnosticCode::annotation_not_inferred:
+      return "annotation-not-inferred";
+    case DiagnosticCode::declaration_end_not_found:
+      return "declaration-end-not-found";
+  }
+  return "unknown";
+}
+
+const char* diagnosticSeverityName(DiagnosticSeverity severity) {
+  switch (severity) {
+    case DiagnosticSeverity::note:
+      return "note";
+    case DiagnosticSeverity::warning:
+      return "warning";
+    case DiagnosticSeverity::error:
+      return "error";
+  }
+  return "unknown";
+}
+
+std::string Diagnostic::describe(const std::string& base_path) const {
+  std::string result = tree.empty() ? "" : tree + ": ";
+  result.append(symbol.empty() ? message : symbol + ": " + message);
+  result.append("\n");
+  for (const Declaration& declaration : declarations) {
+    declaration.appendDescription(&result, base_path);
+  }
+  return result;
+}
+
+static void appendJsonString(std::string* out, const std::string& str) {
+  out->push_back('"');
+  for (char c : str) {
+    switch (c) {
+      case '"':
+        out->append("\\\"");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          char escape[8];
+          snprintf(escape, sizeof(escape), "\\u%04x", c);
+          out->append(escape);
+        } else {
+          out->push_back(c);
+        }
+        break;
+    }
+  }
+  out->push_back('"');
+}
+
+std::string Diagnostic::toJson() const {
+  std::string result = "{\"code\":";
+  appendJsonString(&result, diagnosticCodeName(code));
+  result.append(",\"severity\":");
+  appendJsonString(&result, diagnosticSeverityName(severity));
+  result.append(",\"symbol\":");
+  appendJsonString(&result, symbol);
+  result.append(",\"message\":");
+  appendJsonString(&result, message);
+
+  if (!tree.empty()) {
+    result.append(",\"tree\":");
+    appendJsonString(&result, tree);
+  }
+
+  if (!filename.empty()) {
+    result.append(",\"file\":");
+    appendJsonString(&result, filename);
+    result.append(",\"line\":" + std::to_string(line_number));
+  }
+
+  result.append(",\"types\":[");
+  for (size_t i = 0; i < types.size(); ++i) {
+    if (i != 0) {
+      result.push_back(',');
+    }
+    appendJsonString(&result, types[i].describe());
+  }
+  result.push_back(']');
+
+  if (!declarations.empty()) {
+    result.append(",\"locations\":[");
+    bool first = true;
+    for (const Declaration& declaration : declarations) {
+      for (const DeclarationLocation& location : declaration.locations) {
+        if (!first) {
+          result.push_back(',');
+        }
+        first = false;
+
+        result.append("{\"file\":");
+        appendJsonString(&result, location.filename);
+        result.append(",\"line\":" + std::to_string(location.line_number));
+        result.append(",\"column\":" + std::to_string(location.column));
+        result.append(",\"kind\":");
+        appendJsonString(&result, declarationTypeName(location.type));
+        result.append(",\"extern\":");
+        result.append(location.is_extern ? "true" : "false");
+        result.append(",\"definition\":");
+        result.append(location.is_definition ? "true" : "false");
+        result.append(",\"introduced\":" + std::to_string(location.availability.introduced));
+        result.append(",\"deprecated\":" + std::to_string(location.availability.deprecated));
+        result.append(",\"obsoleted\":" + std::to_string(location.availability.obsoleted));
+        result.push_back('}');
+      }
+    }
+    result.push_back(']');
+  }
+
+  result.append("}\n");
+  return result;
+}
+
+DiagnosticWriter::DiagnosticWriter(FILE* out, DiagnosticFormat format, std::string base_path)
+    : out(out), format(format), base_path(std::move(base_path)) {
+  buffer.reserve(diagnostic_buffer_size);
+}
+
+DiagnosticWriter::~DiagnosticWriter() {
+  flush();
+}
+
+void DiagnosticWriter::report(Diagnostic diagnostic) {
+  std::string rendered;
+  switch (format) {
+    case DiagnosticFormat::text:
+      rendered = diagnostic.describe(base_path);
+      break;
+
+    case DiagnosticFormat::json:
+      rendered = diagnostic.toJson();
+      break;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  buffer.append(rendered);
+  if (buffer.size() >= diagnostic_buffer_size) {
+    flushLocked();
+  }
+}
+
+void DiagnosticWriter::flushLocked() {
+  if (!buffer.empty()) {
+    fwrite(buffer.data(), 1, buffer.size(), out);
+    buffer.clear();
+  }
+  fflush(out);
+}
+
+void DiagnosticWriter::flush() {
+  std::lock_guard<std::mutex> lock(mutex);
+  flushLocked();
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "DeclarationDatabase.h"
+
+// Stable identifiers for each kind of problem, for consumers of the machine-readable output.
+// Don't renumber or rename these; add new ones instead.
+enum class DiagnosticCode {
+  inconsistent_declarations,
+  inconsistent_across_levels,
+  not_in_any_platform,
+  missing_declaration,
+  symbol_type_mismatch,
+  missing_symbol,
+  undeclared_availability,
+  not_on_device,
+  missing_on_device,
+  symbol_version_mismatch,
+  exported_before_introduction,
+  removed_on_device,
+  library_drift_summary,
+  stub_symbol_missing_on_device,
+  stub_type_mismatch,
+  stub_size_mismatch,
+  availability_added,
+  availability_removed,
+  availability_changed,
+  unresolved_in_stub,
+  signature_mismatch,
+  cxx_linkage_mismatch,
+  cxx_availability_mismatch,
+  unlocatable_declaration,
+  annotation_not_inferred,
+  declaration_end_not_found,
+};
+
+const char* diagnosticCodeName(DiagnosticCode code);
+
+enum class DiagnosticSeverity {
+  note,
+  warning,
+  error,
+};
+
+const char* diagnosticSeverityName(DiagnosticSeverity severity);
+
+// A problem found by one of the checks.
+struct Diagnostic {
+  DiagnosticCode code;
+  DiagnosticSeverity severity = DiagnosticSeverity::error;
+
+  std::string symbol;
+  std::string message;
+
+  // The header tree that the diagnostic is about, when checking several at once.
+  std::string tree;
+
+  // The declaration that the diagnostic refers to, if any.
+  std::string filename;
+  unsigned line_number = 0;
+
+  // The compilation types involved, if any.
+  std::vector<CompilationType> types;
+
+  // Declarations whose locations are relevant to the diagnostic.
+  std::vector<Declaration> declarations;
+
+  // Render the diagnostic as human-readable text, with filenames relative to base_path.
+  std::string describe(const std::string& base_path = "") const;
+
+  // Render the diagnostic as a single line of JSON, terminated by a newline.
+  std::string toJson() const;
+};
+
+// Something that diagnostics can be reported to. report may be called from multiple threads.
+class DiagnosticSink {
+ public:
+  virtual ~DiagnosticSink() = default;
+  virtual void report(Diagnostic diagnostic) = 0;
+};
+
+// Collects diagnostics into a vector.
+class DiagnosticCollector : public DiagnosticSink {
+  std::mutex mutex;
+  std::vector<Diagnostic>& diagnostics;
+
+ public:
+  explicit DiagnosticCollector(std::vector<Diagnostic>& diagnostics) : diagnostics(diagnostics) {
+  }
+
+  void report(Diagnostic diagnostic) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    diagnostics.push_back(std::move(diagnostic));
+  }
+};
+
+enum class DiagnosticFormat {
+  text,
+  json,
+};
+
+// Renders diagnostics and writes them out in large chunks. Each diagnostic is rendered by the
+// reporting thread, and then appended to the buffer as a whole, so concurrent reports never
+// interleave.
+class DiagnosticWriter : public DiagnosticSink {
+  FILE* out;
+  DiagnosticFormat format;
+  std::string base_path;
+
+  std::mutex mutex;
+  std::string buffer;
+
+  void flushLocked();
+
+ public:
+  DiagnosticWriter(FILE* out, DiagnosticFormat format, std::string base_path = "");
+  ~DiagnosticWriter();
+
+  void report(Diagnostic diagnostic) override;
+  void flush();
+};
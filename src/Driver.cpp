@@ -0,0 +1,804 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Driver.h"
+
+#include <dirent.h>
+#include <err.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "clang/AST/ASTContext.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Tooling/Tooling.h"
+
+#include "CostDatabase.h"
+#include "DeclarationDatabase.h"
+#include "FileCache.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace std::string_literals;
+using namespace clang::tooling;
+
+bool verbose;
+
+class HeaderCompilationDatabase : public CompilationDatabase {
+  CompilationType type;
+  std::string cwd;
+  std::vector<std::string> headers;
+  std::vector<std::string> include_dirs;
+
+ public:
+  HeaderCompilationDatabase(CompilationType type, std::string cwd, std::vector<std::string> headers,
+                            std::vector<std::string> include_dirs)
+      : type(type),
+        cwd(std::move(cwd)),
+        headers(std::move(headers)),
+        include_dirs(std::move(include_dirs)) {
+  }
+
+  CompileCommand generateCompileCommand(const std::string& filename) const {
+    std::vector<std::string> command = { "clang-tool", filename, "-nostdlibinc" };
+    for (const auto& dir : include_dirs) {
+      command.push_back("-isystem");
+      command.push_back(dir);
+    }
+    if (type.language == CompilationLanguage::cxx) {
+      command.push_back("-std=c++11");
+
+      // Errors from every header accumulate in one translation unit, and hitting the limit would
+      // end the compilation early.
+      command.push_back("-ferror-limit=0");
+    } else {
+      command.push_back("-std=c11");
+    }
+    command.push_back("-DANDROID");
+    command.push_back("-D__ANDROID_API__="s + std::to_string(type.api_level));
+    command.push_back("-D_FORTIFY_SOURCE=2");
+    command.push_back("-D_GNU_SOURCE");
+    command.push_back("-Wno-unknown-attributes");
+    command.push_back("-target");
+    command.push_back(findArch(type.arch)->target);
+
+    return CompileCommand(cwd, filename, command);
+  }
+
+  std::vector<CompileCommand> getAllCompileCommands() const override {
+    std::vector<CompileCommand> commands;
+    for (const std::string& file : headers) {
+      commands.push_back(generateCompileCommand(file));
+    }
+    return commands;
+  }
+
+  std::vector<CompileCommand> getCompileCommands(StringRef file) const override {
+    std::vector<CompileCommand> commands;
+    commands.push_back(generateCompileCommand(file));
+    return commands;
+  }
+
+  std::vector<std::string> getAllFiles() const override {
+    return headers;
+  }
+};
+
+// Equivalent to the action used by ClangTool::buildASTs, except that each AST is parsed into the
+// HeaderDatabase and freed as soon as it's built, and the time spent on each header is recorded.
+class HeaderParseAction : public ToolAction {
+  HeaderDatabase& database;
+
+ public:
+  // Pairs of (absolute header path, duration in microseconds).
+  std::vector<std::pair<std::string, uint64_t>> durations;
+
+  // Time spent collecting declarations from the ASTs, in microseconds.
+  uint64_t collect_time = 0;
+
+  // The memory allocated by the largest AST, in bytes.
+  uint64_t max_ast_memory = 0;
+
+  // Whether any compilation hit a fatal error, after which clang stops processing includes.
+  bool fatal_error = false;
+
+  explicit HeaderParseAction(HeaderDatabase& database) : database(database) {
+  }
+
+  bool runInvocation(clang::CompilerInvocation* invocation, clang::FileManager* files,
+                     std::shared_ptr<clang::PCHContainerOperations> pch_container_ops,
+                     clang::DiagnosticConsumer* diag_consumer) override {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<clang::ASTUnit> ast = clang::ASTUnit::LoadFromCompilerInvocation(
+      invocation, std::move(pch_container_ops),
+      clang::CompilerInstance::createDiagnostics(&invocation->getDiagnosticOpts(), diag_consumer,
+                                                 false),
+      files);
+    if (!ast) {
+      return false;
+    }
+
+    clang::ASTContext& ctx = ast->getASTContext();
+    uint64_t ast_memory = ctx.getASTAllocatedMemory() + ctx.getSideTableAllocatedMemory() +
+                          ctx.getSourceManager().getContentCacheSize();
+    max_ast_memory = std::max(max_ast_memory, ast_memory);
+    fatal_error |= ast->getDiagnostics().hasFatalErrorOccurred();
+
+    auto collect_start = std::chrono::steady_clock::now();
+    database.parseAST(ast.get());
+
+    auto end = std::chrono::steady_clock::now();
+    collect_time +=
+      std::chrono::duration_cast<std::chrono::microseconds>(end - collect_start).count();
+
+    auto duration = end - start;
+    durations.emplace_back(invocation->getFrontendOpts().Inputs[0].getFile(),
+                           std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    return true;
+  }
+};
+
+// Limits how many compilations run at once, so that their memory use stays within a budget.
+// Compilations are admitted while the resident memory of the process, or the memory reserved by
+// the running compilations (whichever is higher), leaves room for one more. Each compilation
+// reserves the most that any AST has needed so far, and holds the reservation until its
+// declarations have been transposed. One compilation is always admitted, so that progress is made
+// even if the budget is too small.
+class MemoryAdmission {
+  // Used until the first compilation has finished and we know how big an AST actually is.
+  static constexpr uint64_t initial_estimate = 512 * 1024 * 1024;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t budget;
+  uint64_t base_memory;
+  uint64_t reserved = 0;
+  uint64_t estimate = initial_estimate;
+  bool estimated = false;
+  size_t running = 0;
+
+ public:
+  uint64_t peak_memory = 0;
+  size_t peak_running = 0;
+
+  explicit MemoryAdmission(uint64_t budget) : budget(budget), base_memory(getResidentMemory()) {
+    peak_memory = base_memory;
+  }
+
+  // Wait until there's room for another compilation. Returns the amount reserved for it.
+  uint64_t admit() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      uint64_t resident = getResidentMemory();
+      peak_memory = std::max(peak_memory, resident);
+
+      uint64_t projected = std::max(resident, base_memory + reserved);
+      if (running == 0 || projected + estimate <= budget) {
+        ++running;
+        peak_running = std::max(peak_running, running);
+        reserved += estimate;
+        return estimate;
+      }
+
+      // Memory can be freed without anything finishing, so poll as well.
+      cv.wait_for(lock, std::chrono::milliseconds(100));
+    }
+  }
+
+  // Release a compilation's reservation, and learn from how much memory its ASTs needed.
+  void release(uint64_t reservation, uint64_t ast_memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    peak_memory = std::max(peak_memory, getResidentMemory());
+    --running;
+    reserved -= reservation;
+    if (ast_memory != 0) {
+      estimate = estimated ? std::max(estimate, ast_memory) : ast_memory;
+      estimated = true;
+    }
+    cv.notify_all();
+  }
+};
+
+struct CompilationRequirements {
+  std::vector<std::string> headers;
+  std::vector<std::string> dependencies;
+
+  // Every file that the compilations might read: the headers, and the contents of the
+  // dependencies.
+  std::vector<std::string> files;
+};
+
+static CompilationRequirements collectRequirements(const std::string& arch,
+                                                   const std::string& header_dir,
+                                                   const std::string& dependency_dir) {
+  std::vector<std::string> headers = collectFiles(header_dir);
+
+  std::vector<std::string> dependencies = { header_dir };
+  if (!dependency_dir.empty()) {
+    auto collect_children = [&dependencies](const std::string& dir_path) {
+      DIR* dir = opendir(dir_path.c_str());
+      if (!dir) {
+        err(1, "failed to open dependency dir");
+      }
+
+      struct dirent* dent;
+      while ((dent = readdir(dir))) {
+        if (dent->d_name[0] == '.') {
+          continue;
+        }
+
+        // TODO: Resolve symlinks.
+        std::string dependency = dir_path + "/" + dent->d_name;
+        dependencies.push_back(dependency);
+      }
+
+      closedir(dir);
+    };
+
+    collect_children(dependency_dir + "/common");
+    collect_children(dependency_dir + "/" + arch);
+  }
+
+  uint32_t arch_bit = archBit(findArch(arch)->arch);
+  auto is_blacklisted = [arch_bit](const std::string& header) {
+    for (const BlacklistedHeader& blacklisted : header_blacklist) {
+      if ((blacklisted.archs & arch_bit) == 0) {
+        continue;
+      }
+
+      if (EndsWith(header, "/"s + blacklisted.path)) {
+        return true;
+      }
+    }
+    return false;
+  };
+
+  auto new_end = std::remove_if(headers.begin(), headers.end(), is_blacklisted);
+
+  headers.erase(new_end, headers.end());
+
+  std::vector<std::string> files = headers;
+  for (size_t i = 1; i < dependencies.size(); ++i) {
+    std::vector<std::string> dependency_files = collectFiles(dependencies[i]);
+    files.insert(files.end(), dependency_files.begin(), dependency_files.end());
+  }
+
+  CompilationRequirements result = { .headers = headers, .dependencies = dependencies,
+                                     .files = files };
+  return result;
+}
+
+std::set<CompilationType> generateCompilationTypes(const std::set<std::string>& selected_archs,
+                                                   const std::set<int>& selected_levels) {
+  std::set<CompilationType> result;
+  for (const std::string& arch : selected_archs) {
+    int min_api = archMinApi(arch);
+    for (int api_level : selected_levels) {
+      if (api_level < min_api) {
+        continue;
+      }
+      CompilationType type = { .arch = arch, .api_level = api_level };
+      result.insert(type);
+    }
+  }
+  return result;
+}
+
+// Transposes the HeaderDatabase of each compiled type into its tree's DeclarationDatabase on a
+// thread of its own, as soon as the compilation finishes, so that little is left to do once the
+// last one does. Types are transposed in the order they finish, which follows the longest-first
+// schedule rather than type order, so the databases are built out of order.
+//
+// A compilation's memory reservation is only released once its declarations have been transposed,
+// so that the memory budget also covers the databases waiting for the transposer.
+class TransposePipeline {
+  struct Stream {
+    size_t tree;
+    CompilationLanguage language;
+    DeclarationDatabase* database;
+
+    // The types of each architecture, and how many of them haven't been transposed yet.
+    std::map<std::string, std::set<CompilationType>> arch_types;
+    std::map<std::string, size_t> arch_remaining;
+  };
+
+  struct Finished {
+    Stream* stream;
+    CompilationType type;
+    HeaderDatabase database;
+    uint64_t reservation;
+    uint64_t ast_memory;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Finished> queue;
+  std::vector<Stream> streams;
+  size_t remaining = 0;
+  bool compiling = true;
+  MemoryAdmission& admission;
+  const ArchCompiledCallback& on_arch_compiled;
+  std::thread thread;
+
+  Stream* findStream(size_t tree, CompilationLanguage language) {
+    for (Stream& stream : streams) {
+      if (stream.tree == tree && stream.language == language) {
+        return &stream;
+      }
+    }
+    errx(1, "no transposition stream for tree %zu", tree);
+  }
+
+  void transpose(Finished& item) {
+    Stream& stream = *item.stream;
+    for (const Declaration& declaration : item.database.declarations) {
+      stream.database->insert(item.type, declaration);
+    }
+
+    // Each distinct declaration has been copied, so drop the original before releasing its memory.
+    item.database = HeaderDatabase();
+    admission.release(item.reservation, item.ast_memory);
+
+    bool arch_done = --stream.arch_remaining[item.type.arch] == 0;
+    if (arch_done && on_arch_compiled && stream.language == CompilationLanguage::c) {
+      on_arch_compiled(stream.tree, stream.arch_types[item.type.arch], *stream.database);
+    }
+  }
+
+  void run() {
+    while (true) {
+      Finished item;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this]() { return !queue.empty() || remaining == 0; });
+        if (queue.empty()) {
+          return;
+        }
+        item = std::move(queue.front());
+        queue.pop_front();
+        if (compiling) {
+          ++transposed_early;
+        }
+      }
+
+      transpose(item);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      --remaining;
+    }
+  }
+
+ public:
+  // How many types were taken for transposition before the last compilation finished.
+  size_t transposed_early = 0;
+
+  TransposePipeline(MemoryAdmission& admission, const ArchCompiledCallback& on_arch_compiled)
+      : admission(admission), on_arch_compiled(on_arch_compiled) {
+  }
+
+  // Expect the given types of a tree, all of one language, to be compiled into database.
+  void addStream(size_t tree, DeclarationDatabase* database,
+                 const std::vector<CompilationType>& types) {
+    if (types.empty()) {
+      return;
+    }
+
+    Stream stream = {
+      .tree = tree,
+      .language = types[0].language,
+      .database = database,
+    };
+    for (const CompilationType& type : types) {
+      stream.arch_types[type.arch].insert(type);
+      ++stream.arch_remaining[type.arch];
+    }
+    remaining += types.size();
+    streams.push_back(std::move(stream));
+  }
+
+  void start() {
+    thread = std::thread([this]() { run(); });
+  }
+
+  // Queue a compiled type for transposition, along with its memory reservation.
+  void add(size_t tree, const CompilationType& type, HeaderDatabase database,
+           uint64_t reservation, uint64_t ast_memory) {
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back({ findStream(tree, type.language), type, std::move(database), reservation,
+                      ast_memory });
+    cv.notify_one();
+  }
+
+  // Wait until every expected type has been transposed, once the compilations are done.
+  void finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      compiling = false;
+    }
+    thread.join();
+  }
+};
+
+// Record a compilation of type by action, which compiled the given number of headers. A C++
+// umbrella unit counts as one header, however many it includes.
+static void recordParse(const CompilationType& type, const HeaderParseAction& action,
+                        size_t headers) {
+  uint64_t parse_time = 0;
+  for (const auto& duration : action.durations) {
+    parse_time += duration.second;
+  }
+  run_metrics.recordCompilation(type, action.durations.size(), headers, parse_time);
+}
+
+// Run action over sources, with every file that they might read mapped in from the file cache,
+// along with the contents of the umbrella file, if there is one.
+static void runTool(const CompilationType& type, const std::string& cwd,
+                    const CompilationRequirements& req, const std::vector<std::string>& sources,
+                    HeaderParseAction& action, const std::string& umbrella_path = "",
+                    llvm::StringRef umbrella = llvm::StringRef()) {
+  HeaderCompilationDatabase compilationDatabase(type, cwd, sources, req.dependencies);
+  ClangTool tool(compilationDatabase, sources);
+  for (const std::string& file : req.files) {
+    llvm::StringRef contents;
+    if (file_cache.find(file, &contents)) {
+      tool.mapVirtualFile(file, contents);
+    }
+  }
+  if (!umbrella_path.empty()) {
+    tool.mapVirtualFile(umbrella_path, umbrella);
+  }
+  tool.run(&action);
+}
+
+std::vector<DeclarationDatabase> compileHeaderTrees(
+  const std::set<CompilationType>& types, const std::vector<HeaderTree>& trees,
+  ParseCostDatabase& parse_costs, uint64_t memory_budget,
+  std::vector<DeclarationDatabase>* cxx_databases, const ArchCompiledCallback& on_arch_compiled) {
+  PhaseTimer phase_timer("compile");
+  std::mutex mutex;
+  std::vector<std::thread> threads;
+
+  // Map from tree index to the requirements of each arch.
+  std::vector<std::unordered_map<std::string, CompilationRequirements>> requirements(trees.size());
+
+  std::string cwd = getWorkingDir();
+
+  // The translation unit that includes every header, for the C++ compilations.
+  std::string umbrella_path = cwd + "/__versioner_cxx_umbrella.cpp";
+
+  std::set<CompilationType> cxx_types;
+  if (cxx_databases) {
+    for (const CompilationType& type : types) {
+      cxx_types.insert(type.as(CompilationLanguage::cxx));
+    }
+  }
+
+  // Only the architectures that are actually being compiled need their files read.
+  std::set<std::string> archs;
+  for (const CompilationType& type : types) {
+    archs.insert(type.arch);
+  }
+
+  for (size_t i = 0; i < trees.size(); ++i) {
+    const HeaderTree& tree = trees[i];
+    for (const std::string& arch : archs) {
+      CompilationRequirements& req = requirements[i][arch];
+      req = collectRequirements(arch, tree.header_dir, tree.dependency_dir);
+
+      if (tree.restrict_headers) {
+        auto new_end =
+          std::remove_if(req.headers.begin(), req.headers.end(), [&tree](const std::string& path) {
+            return tree.only_headers.count(getRelativePath(path, tree.header_dir)) == 0;
+          });
+        req.headers.erase(new_end, req.headers.end());
+      }
+    }
+  }
+
+  // Read everything that the compilations will need up front, so that they don't block on the
+  // filesystem one file at a time.
+  std::vector<std::string> manifest;
+  for (const auto& tree_requirements : requirements) {
+    for (const auto& it : tree_requirements) {
+      manifest.insert(manifest.end(), it.second.files.begin(), it.second.files.end());
+    }
+  }
+  file_cache.prefetch(manifest);
+
+  // Parse costs are keyed by the path relative to the header directory, so that they remain valid
+  // across different checkouts. Map from the absolute path that clang sees to that key.
+  std::unordered_map<std::string, std::string> header_keys;
+
+  // Map from tree index to a map from arch to the sizes of its headers.
+  std::vector<std::unordered_map<std::string, std::vector<std::pair<std::string, uint64_t>>>>
+    header_sizes(trees.size());
+  for (size_t i = 0; i < trees.size(); ++i) {
+    const std::string& header_dir = trees[i].header_dir;
+    for (const auto& it : requirements[i]) {
+      for (const std::string& header : it.second.headers) {
+        std::string key = getRelativePath(header, header_dir);
+
+        uint64_t size;
+        llvm::StringRef contents;
+        if (file_cache.find(header, &contents)) {
+          size = contents.size();
+        } else {
+          struct stat st;
+          if (stat(header.c_str(), &st) != 0) {
+            err(1, "failed to stat header '%s'", header.c_str());
+          }
+          size = st.st_size;
+        }
+
+        header_keys[getAbsolutePath(header)] = key;
+        header_sizes[i][it.first].emplace_back(key, size);
+      }
+    }
+  }
+
+  // Schedule the most expensive compilations of every tree first (longest processing time first),
+  // so that the run isn't held up by a heavy type that happened to start last. Ties go to higher
+  // API levels, which have more declarations.
+  struct Job {
+    uint64_t cost;
+    size_t tree;
+    CompilationType type;
+  };
+
+  std::vector<Job> schedule;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    for (const CompilationType& type : types) {
+      if (requirements[i][type.arch].headers.empty()) {
+        continue;
+      }
+      uint64_t cost = parse_costs.estimate(type, header_sizes[i][type.arch]);
+      schedule.push_back({ cost, i, type });
+      if (cxx_databases) {
+        schedule.push_back({ cost, i, type.as(CompilationLanguage::cxx) });
+      }
+    }
+  }
+
+  std::sort(schedule.begin(), schedule.end(), [](const Job& lhs, const Job& rhs) {
+    if (lhs.cost != rhs.cost) {
+      return lhs.cost > rhs.cost;
+    }
+    if (lhs.type.api_level != rhs.type.api_level) {
+      return lhs.type.api_level > rhs.type.api_level;
+    }
+    return std::tie(lhs.type.arch, lhs.tree) < std::tie(rhs.type.arch, rhs.tree);
+  });
+
+  // The declarations of each tree, which are filled in as the compilations finish.
+  std::vector<DeclarationDatabase> result;
+  std::vector<DeclarationDatabase> cxx_result;
+  for (size_t i = 0; i < trees.size(); ++i) {
+    result.emplace_back(types);
+    if (cxx_databases) {
+      cxx_result.emplace_back(cxx_types);
+    }
+  }
+
+  if (memory_budget == 0) {
+    memory_budget = getPhysicalMemory() / 4 * 3;
+  }
+  MemoryAdmission admission(memory_budget);
+
+  TransposePipeline pipeline(admission, on_arch_compiled);
+  for (size_t i = 0; i < trees.size(); ++i) {
+    std::vector<CompilationType> tree_types;
+    std::vector<CompilationType> tree_cxx_types;
+    for (const Job& job : schedule) {
+      if (job.tree == i) {
+        auto& list = job.type.language == CompilationLanguage::c ? tree_types : tree_cxx_types;
+        list.push_back(job.type);
+      }
+    }
+    pipeline.addStream(i, &result[i], tree_types);
+    if (cxx_databases) {
+      pipeline.addStream(i, &cxx_result[i], tree_cxx_types);
+    }
+  }
+  pipeline.start();
+
+  // Total time spent collecting declarations from the ASTs, in microseconds.
+  uint64_t collect_time = 0;
+  HeaderDatabase::Stats collect_stats;
+
+  // Time that the workers spent on compilations, rather than waiting for admission.
+  std::chrono::steady_clock::duration busy_time(0);
+
+  std::atomic<size_t> next_job(0);
+  auto worker = [&]() {
+    while (true) {
+      size_t job = next_job++;
+      if (job >= schedule.size()) {
+        return;
+      }
+
+      uint64_t reservation = admission.admit();
+      auto job_start = std::chrono::steady_clock::now();
+
+      const CompilationType& type = schedule[job].type;
+      size_t tree = schedule[job].tree;
+      const auto& req = requirements[tree][type.arch];
+
+      HeaderDatabase database;
+      std::unique_ptr<HeaderParseAction> action(new HeaderParseAction(database));
+      if (type.language == CompilationLanguage::cxx) {
+        // Rather than compiling every header on its own again, compile one translation unit that
+        // includes all of them, so that each header is only preprocessed and analyzed once. They're
+        // included by the names that they include each other by, so that their declarations have
+        // the same locations as in the C compilations, which is how the two are matched up.
+        std::string umbrella;
+        for (const std::string& header : req.headers) {
+          umbrella += "#include <" + getRelativePath(header, trees[tree].header_dir) + ">\n";
+        }
+        runTool(type, cwd, req, { umbrella_path }, *action, umbrella_path, umbrella);
+
+        // After a fatal error (e.g. an include that only exists for C++), clang stops including
+        // anything else, so fall back to compiling the headers one at a time, with a fresh action.
+        // The abandoned umbrella is still recorded as the one translation unit that it was.
+        if (action->fatal_error) {
+          recordParse(type, *action, 1);
+          uint64_t umbrella_collect_time = action->collect_time;
+          uint64_t umbrella_memory = action->max_ast_memory;
+
+          database = HeaderDatabase();
+          action.reset(new HeaderParseAction(database));
+          runTool(type, cwd, req, req.headers, *action);
+          action->collect_time += umbrella_collect_time;
+          action->max_ast_memory = std::max(action->max_ast_memory, umbrella_memory);
+          recordParse(type, *action, req.headers.size());
+        } else {
+          recordParse(type, *action, 1);
+        }
+      } else {
+        runTool(type, cwd, req, req.headers, *action);
+        recordParse(type, *action, req.headers.size());
+      }
+
+      auto finalize_start = std::chrono::steady_clock::now();
+      database.finalize();
+      auto finalize_time = std::chrono::steady_clock::now() - finalize_start;
+
+      std::unique_lock<std::mutex> l(mutex);
+      collect_time += action->collect_time +
+                      std::chrono::duration_cast<std::chrono::microseconds>(finalize_time).count();
+      collect_stats.mangled_names += database.stats.mangled_names;
+      collect_stats.mangles_avoided += database.stats.mangles_avoided;
+      pipeline.add(tree, type, std::move(database), reservation, action->max_ast_memory);
+      busy_time += std::chrono::steady_clock::now() - job_start;
+
+      // Parse costs are only kept for the per-header C compilations.
+      if (type.language != CompilationLanguage::c) {
+        continue;
+      }
+      for (const auto& duration : action->durations) {
+        auto key_it = header_keys.find(duration.first);
+        if (key_it != header_keys.end()) {
+          parse_costs.record(type, key_it->second, duration.second);
+        }
+      }
+    }
+  };
+
+  // The admission control decides how many of these actually run at once.
+  size_t thread_count = std::min<size_t>(std::max(1U, std::thread::hardware_concurrency()),
+                                         schedule.size());
+  auto threads_start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto threads_time = std::chrono::steady_clock::now() - threads_start;
+  pipeline.finish();
+
+  run_metrics.add(RunCounter::compile_thread_busy_us,
+                  std::chrono::duration_cast<std::chrono::microseconds>(busy_time).count());
+  run_metrics.add(
+    RunCounter::compile_thread_capacity_us,
+    thread_count * std::chrono::duration_cast<std::chrono::microseconds>(threads_time).count());
+  run_metrics.raise(RunCounter::peak_compilations, admission.peak_running);
+  run_metrics.add(RunCounter::types_transposed_early, pipeline.transposed_early);
+  run_metrics.add(RunCounter::names_mangled, collect_stats.mangled_names);
+  run_metrics.add(RunCounter::mangles_avoided, collect_stats.mangles_avoided);
+  for (const DeclarationDatabase& database : result) {
+    run_metrics.add(RunCounter::symbols, database.size());
+    run_metrics.add(RunCounter::declaration_ranges, database.rangeCount());
+    run_metrics.add(RunCounter::distinct_declarations, database.distinctDeclarationCount());
+  }
+
+  if (verbose) {
+    fprintf(stderr,
+            "collected declarations from %zu compilations in %llu ms of CPU time "
+            "(%zu names mangled, %zu mangles avoided)\n",
+            schedule.size(), static_cast<unsigned long long>(collect_time / 1000),
+            collect_stats.mangled_names, collect_stats.mangles_avoided);
+    fprintf(stderr,
+            "peak resident memory %llu MB (budget %llu MB), at most %zu compilations at once\n",
+            static_cast<unsigned long long>(admission.peak_memory >> 20),
+            static_cast<unsigned long long>(memory_budget >> 20), admission.peak_running);
+    fprintf(stderr, "transposed %zu of %zu compiled types while compilations were running\n",
+            pipeline.transposed_early, schedule.size());
+  }
+
+  if (verbose) {
+    for (const DeclarationDatabase& database : result) {
+      fprintf(stderr, "%zu symbols declared in %zu ranges of %zu distinct declarations\n",
+              database.size(), database.rangeCount(), database.distinctDeclarationCount());
+    }
+  }
+
+  if (cxx_databases) {
+    std::move(cxx_result.begin(), cxx_result.end(), std::back_inserter(*cxx_databases));
+  }
+  return result;
+}
+
+DeclarationDatabase compileHeaders(const std::set<CompilationType>& types,
+                                   const std::string& header_dir,
+                                   const std::string& dependency_dir,
+                                   ParseCostDatabase& parse_costs, uint64_t memory_budget,
+                                   DeclarationDatabase* cxx_database,
+                                   const ArchCompiledCallback& on_arch_compiled) {
+  std::vector<DeclarationDatabase> cxx_databases;
+  std::vector<DeclarationDatabase> result =
+    compileHeaderTrees(types, { { .header_dir = header_dir, .dependency_dir = dependency_dir } },
+                       parse_costs, memory_budget, cxx_database ? &cxx_databases : nullptr,
+                       on_arch_compiled);
+  if (cxx_database) {
+    *cxx_database = std::move(cxx_databases[0]);
+  }
+  return std::move(result[0]);
+}
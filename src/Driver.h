@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "CostDatabase.h"
+#include "DeclarationDatabase.h"
+
+// Called as soon as a tree's declarations are complete for every C type of one architecture, while
+// other compilations may still be running. Calls are made one at a time, in the order that the
+// architectures complete, and the database may only be read for the duration of the call.
+using ArchCompiledCallback = std::function<void(
+  size_t tree, const std::set<CompilationType>& types, const DeclarationDatabase& database)>;
+
+std::set<CompilationType> generateCompilationTypes(const std::set<std::string>& selected_archs,
+                                                   const std::set<int>& selected_levels);
+
+// Compile every header in header_dir for each type, and collect their declarations.
+// Per-header parse times are recorded into parse_costs, and used to order the work.
+// Compilations are only started while the process's memory use stays under memory_budget bytes
+// (by default, three quarters of the machine's physical memory).
+// If cxx_database is non-null, the headers are also compiled as C++ for each type, and the
+// declarations that C++ sees are stored there, under the C++ versions of the types.
+DeclarationDatabase compileHeaders(const std::set<CompilationType>& types,
+                                   const std::string& header_dir,
+                                   const std::string& dependency_dir,
+                                   ParseCostDatabase& parse_costs, uint64_t memory_budget = 0,
+                                   DeclarationDatabase* cxx_database = nullptr,
+                                   const ArchCompiledCallback& on_arch_compiled = nullptr);
+
+struct HeaderTree {
+  std::string header_dir;
+  std::string dependency_dir;
+
+  // If set, only compile the headers in only_headers (relative to header_dir).
+  bool restrict_headers = false;
+  std::set<std::string> only_headers;
+};
+
+// Compile several header trees, scheduling all of their compilations on a single worker pool.
+// Returns the declarations of each tree, in the same order as trees, and appends the declarations
+// that C++ sees in each tree to cxx_databases, if it's non-null. Each compiled type is transposed
+// into the results as soon as its compilation is done, and on_arch_compiled is called
+// with the index of the tree as each of its architectures is completed.
+std::vector<DeclarationDatabase> compileHeaderTrees(
+  const std::set<CompilationType>& types, const std::vector<HeaderTree>& trees,
+  ParseCostDatabase& parse_costs, uint64_t memory_budget = 0,
+  std::vector<DeclarationDatabase>* cxx_databases = nullptr,
+  const ArchCompiledCallback& on_arch_compiled = nullptr);
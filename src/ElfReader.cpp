@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "ElfReader.h"
+
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "FileCache.h"
+
+using llvm::StringRef;
+
+// The high bit of a .gnu.version entry marks the symbol as a non-default version.
+static constexpr uint16_t versym_hidden = 0x8000;
+
+ElfLibrary::~ElfLibrary() {
+  if (mapped) {
+    munmap(const_cast<uint8_t*>(data), data_size);
+  }
+}
+
+void ElfLibrary::fail(const char* reason) const {
+  errx(1, "failed to parse %s as ELF: %s", path.c_str(), reason);
+}
+
+StringRef ElfLibrary::stringAt(StringRef table, size_t offset) const {
+  size_t length = strnlen(table.data() + offset, table.size() - offset);
+  if (length == table.size() - offset) {
+    fail("unterminated string");
+  }
+  return StringRef(table.data() + offset, length);
+}
+
+void ElfLibrary::map() {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    err(1, "failed to open library at %s", path.c_str());
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    err(1, "failed to stat library at %s", path.c_str());
+  }
+
+  if (st.st_size < static_cast<off_t>(EI_NIDENT)) {
+    fail("file too small");
+  }
+
+  void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    err(1, "failed to map library at %s", path.c_str());
+  }
+
+  data = static_cast<const uint8_t*>(mapping);
+  data_size = st.st_size;
+  mapped = true;
+}
+
+std::unique_ptr<ElfLibrary> ElfLibrary::open(const std::string& path) {
+  std::unique_ptr<ElfLibrary> result(new ElfLibrary());
+  result->path = path;
+
+  llvm::StringRef contents;
+  if (file_cache.find(path, &contents)) {
+    if (contents.size() < EI_NIDENT) {
+      result->fail("file too small");
+    }
+    result->data = reinterpret_cast<const uint8_t*>(contents.data());
+    result->data_size = contents.size();
+  } else {
+    result->map();
+  }
+
+  if (memcmp(result->data, ELFMAG, SELFMAG) != 0) {
+    result->fail("bad magic");
+  }
+
+  // Every architecture we support is little-endian.
+  if (result->data[EI_DATA] != ELFDATA2LSB) {
+    result->fail("not little-endian");
+  }
+
+  switch (result->data[EI_CLASS]) {
+    case ELFCLASS32:
+      result->parse<Elf32_Ehdr, Elf32_Shdr, Elf32_Sym, Elf32_Verdef, Elf32_Verdaux>();
+      break;
+
+    case ELFCLASS64:
+      result->is_64 = true;
+      result->parse<Elf64_Ehdr, Elf64_Shdr, Elf64_Sym, Elf64_Verdef, Elf64_Verdaux>();
+      break;
+
+    default:
+      result->fail("unknown ELF class");
+  }
+
+  return result;
+}
+
+template <typename Elf_Ehdr, typename Elf_Shdr, typename Elf_Sym, typename Elf_Verdef,
+          typename Elf_Verdaux>
+void ElfLibrary::parse() {
+  auto in_bounds = [this](uint64_t offset, uint64_t size) {
+    return offset <= data_size && size <= data_size - offset;
+  };
+
+  if (!in_bounds(0, sizeof(Elf_Ehdr))) {
+    fail("truncated header");
+  }
+
+  const Elf_Ehdr* ehdr = reinterpret_cast<const Elf_Ehdr*>(data);
+  if (ehdr->e_shentsize != sizeof(Elf_Shdr) ||
+      !in_bounds(ehdr->e_shoff, uint64_t(ehdr->e_shnum) * sizeof(Elf_Shdr))) {
+    fail("bad section headers");
+  }
+
+  const Elf_Shdr* shdrs = reinterpret_cast<const Elf_Shdr*>(data + ehdr->e_shoff);
+  auto string_table = [&](uint32_t index) {
+    if (index >= ehdr->e_shnum || !in_bounds(shdrs[index].sh_offset, shdrs[index].sh_size)) {
+      fail("bad string table");
+    }
+    return StringRef(reinterpret_cast<const char*>(data + shdrs[index].sh_offset),
+                     shdrs[index].sh_size);
+  };
+
+  const Elf_Shdr* versym_shdr = nullptr;
+  const Elf_Shdr* verdef = nullptr;
+  for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+    const Elf_Shdr& shdr = shdrs[i];
+    if (shdr.sh_type == SHT_NOBITS || !in_bounds(shdr.sh_offset, shdr.sh_size)) {
+      continue;
+    }
+
+    switch (shdr.sh_type) {
+      case SHT_DYNSYM:
+        if (shdr.sh_entsize < sizeof(Elf_Sym)) {
+          fail("bad .dynsym entry size");
+        }
+        dynsym = data + shdr.sh_offset;
+        dynsym_entsize = shdr.sh_entsize;
+        dynsym_count = shdr.sh_size / shdr.sh_entsize;
+        dynstr = string_table(shdr.sh_link);
+        break;
+
+      case SHT_GNU_versym:
+        versym_shdr = &shdr;
+        break;
+
+      case SHT_GNU_verdef:
+        verdef = &shdr;
+        break;
+    }
+  }
+
+  if (!dynsym) {
+    fail("no .dynsym");
+  }
+
+  if (versym_shdr) {
+    if (versym_shdr->sh_size < dynsym_count * sizeof(uint16_t)) {
+      fail("truncated .gnu.version");
+    }
+    versym = reinterpret_cast<const uint16_t*>(data + versym_shdr->sh_offset);
+  }
+
+  if (!verdef) {
+    return;
+  }
+
+  StringRef verdef_strings = string_table(verdef->sh_link);
+  uint64_t offset = verdef->sh_offset;
+  uint64_t end = verdef->sh_offset + verdef->sh_size;
+  for (size_t i = 0; i < verdef->sh_info; ++i) {
+    if (offset >= end || !in_bounds(offset, sizeof(Elf_Verdef))) {
+      fail("truncated .gnu.version_d");
+    }
+
+    const Elf_Verdef* def = reinterpret_cast<const Elf_Verdef*>(data + offset);
+    uint64_t aux_offset = offset + def->vd_aux;
+    if (def->vd_cnt == 0 || !in_bounds(aux_offset, sizeof(Elf_Verdaux))) {
+      fail("bad version definition");
+    }
+
+    // The base definition is the library's own name, which symbols don't really belong to.
+    if (!(def->vd_flags & VER_FLG_BASE)) {
+      const Elf_Verdaux* aux = reinterpret_cast<const Elf_Verdaux*>(data + aux_offset);
+      if (aux->vda_name >= verdef_strings.size()) {
+        fail("bad version name");
+      }
+
+      uint16_t index = def->vd_ndx & ~versym_hidden;
+      if (versions.size() <= index) {
+        versions.resize(index + 1);
+      }
+      versions[index] = stringAt(verdef_strings, aux->vda_name);
+    }
+
+    if (def->vd_next == 0) {
+      break;
+    }
+    offset += def->vd_next;
+  }
+}
+
+template <typename Elf_Sym>
+ElfSymbol ElfLibrary::symbolAt(size_t index) const {
+  const Elf_Sym* sym = reinterpret_cast<const Elf_Sym*>(dynsym + index * dynsym_entsize);
+
+  ElfSymbol result = {};
+  if (sym->st_name < dynstr.size()) {
+    result.name = stringAt(dynstr, sym->st_name);
+  }
+  result.defined = sym->st_shndx != SHN_UNDEF;
+  result.binding = ELF32_ST_BIND(sym->st_info);
+  result.type = ELF32_ST_TYPE(sym->st_info);
+  result.size = sym->st_size;
+
+  if (versym) {
+    uint16_t version = versym[index];
+    result.hidden = version & versym_hidden;
+    version &= ~versym_hidden;
+    if (version < versions.size()) {
+      result.version = versions[version];
+    }
+  }
+
+  return result;
+}
+
+ElfSymbol ElfLibrary::symbol(size_t index) const {
+  return is_64 ? symbolAt<Elf64_Sym>(index) : symbolAt<Elf32_Sym>(index);
+}
+
+int versionApiLevel(StringRef version) {
+  size_t underscore = version.rfind('_');
+  if (underscore == StringRef::npos) {
+    return 0;
+  }
+
+  StringRef suffix = version.substr(underscore + 1);
+  if (suffix == "N") {
+    return 24;
+  } else if (suffix == "O") {
+    return 26;
+  }
+  return 0;
+}
+
+bool isPrivateVersion(StringRef version) {
+  return version.endswith("_PRIVATE");
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+// A dynamic symbol, pointing directly into the mapped library.
+struct ElfSymbol {
+  llvm::StringRef name;
+
+  // The name of the version definition for the symbol, or empty if it's unversioned.
+  llvm::StringRef version;
+
+  // Whether this is a non-default version of the symbol (foo@VERSION rather than foo@@VERSION).
+  bool hidden;
+
+  bool defined;
+  uint8_t binding;
+  uint8_t type;
+  uint64_t size;
+};
+
+// A read-only view of the dynamic symbol table of an ELF shared library, including the symbol
+// version definitions from .gnu.version and .gnu.version_d. Nothing is copied out of the mapping.
+class ElfLibrary {
+  std::string path;
+  const uint8_t* data = nullptr;
+  size_t data_size = 0;
+  bool is_64 = false;
+
+  // Whether data is our own mapping, rather than the contents of a file in the FileCache.
+  bool mapped = false;
+
+  const uint8_t* dynsym = nullptr;
+  size_t dynsym_count = 0;
+  size_t dynsym_entsize = 0;
+  llvm::StringRef dynstr;
+  const uint16_t* versym = nullptr;
+
+  // Names of the version definitions, indexed by version index.
+  std::vector<llvm::StringRef> versions;
+
+  ElfLibrary() = default;
+  ElfLibrary(const ElfLibrary&) = delete;
+  ElfLibrary& operator=(const ElfLibrary&) = delete;
+
+  template <typename Elf_Ehdr, typename Elf_Shdr, typename Elf_Sym, typename Elf_Verdef,
+            typename Elf_Verdaux>
+  void parse();
+
+  template <typename Elf_Sym>
+  ElfSymbol symbolAt(size_t index) const;
+
+  // Get the string at offset (which must be in bounds) in a string table, exiting if it isn't
+  // terminated before the end of the table.
+  llvm::StringRef stringAt(llvm::StringRef table, size_t offset) const;
+
+  [[noreturn]] void fail(const char* reason) const;
+
+  void map();
+
+ public:
+  ~ElfLibrary();
+
+  // Map and parse a library (or use its contents from the FileCache), exiting on failure.
+  static std::unique_ptr<ElfLibrary> open(const std::string& path);
+
+  size_t symbolCount() const {
+    return dynsym_count;
+  }
+
+  ElfSymbol symbol(size_t index) const;
+
+  template <typename Function>
+  void forEachSymbol(Function fn) const {
+    // Symbol 0 is always the null symbol.
+    for (size_t i = 1; i < dynsym_count; ++i) {
+      fn(symbol(i));
+    }
+  }
+};
+
+// Get the API level in which a bionic symbol version (e.g. LIBC_N) was introduced, or 0 if the
+// version doesn't imply a level.
+int versionApiLevel(llvm::StringRef version);
+
+// Whether a symbol version is for platform-internal use only (e.g. LIBC_PRIVATE).
+bool isPrivateVersion(llvm::StringRef version);
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "ElfWriter.h"
+
+#include <elf.h>
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// Not every elf.h has these.
+#ifndef EF_MIPS_ABI_O32
+#define EF_MIPS_ABI_O32 0x00001000
+#endif
+
+#ifndef EF_MIPS_ARCH_64R6
+#define EF_MIPS_ARCH_64R6 0xa0000000
+#endif
+
+// The headers don't say how big variables are, so as in stubs generated from C, they all get the
+// same placeholder size.
+static constexpr size_t stub_variable_size = 4;
+
+struct ElfTarget {
+  unsigned char elf_class;
+  uint16_t machine;
+  uint32_t flags;
+};
+
+static ElfTarget getElfTarget(Arch arch) {
+  switch (arch) {
+    case Arch::arm:
+      return { ELFCLASS32, EM_ARM, EF_ARM_EABI_VER5 };
+    case Arch::arm64:
+      return { ELFCLASS64, EM_AARCH64, 0 };
+    case Arch::mips:
+      return { ELFCLASS32, EM_MIPS,
+               EF_MIPS_NOREORDER | EF_MIPS_PIC | EF_MIPS_CPIC | EF_MIPS_ABI_O32 | EF_MIPS_ARCH_32 };
+    case Arch::mips64:
+      return { ELFCLASS64, EM_MIPS,
+               EF_MIPS_NOREORDER | EF_MIPS_PIC | EF_MIPS_CPIC | EF_MIPS_ARCH_64R6 };
+    case Arch::x86:
+      return { ELFCLASS32, EM_386, 0 };
+    case Arch::x86_64:
+      return { ELFCLASS64, EM_X86_64, 0 };
+  }
+  errx(1, "unknown architecture");
+}
+
+static size_t alignTo(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static size_t appendString(std::string* table, const std::string& string) {
+  size_t offset = table->size();
+  table->append(string);
+  table->push_back('\0');
+  return offset;
+}
+
+// Lay out a stub library as:
+//   ELF header, program headers, .dynsym, .dynstr, .text (empty), .dynamic, .shstrtab, section
+//   headers
+// with .bss after the end of the file in memory. Addresses are equal to file offsets.
+template <typename Elf_Ehdr, typename Elf_Phdr, typename Elf_Shdr, typename Elf_Sym,
+          typename Elf_Dyn>
+static std::vector<uint8_t> buildStub(const ElfTarget& target, const std::string& soname,
+                                      const std::vector<StubSymbol>& symbols) {
+  enum SectionIndex : uint16_t {
+    shn_dynsym = 1,
+    shn_dynstr,
+    shn_text,
+    shn_bss,
+    shn_dynamic,
+    shn_shstrtab,
+    section_count,
+  };
+
+  static constexpr size_t phdr_count = 2;
+  static constexpr size_t dynamic_count = 6;
+  static constexpr size_t word_size = sizeof(Elf_Dyn) / 2;
+
+  std::string dynstr(1, '\0');
+  size_t soname_offset = appendString(&dynstr, soname);
+  std::vector<size_t> name_offsets;
+  size_t variable_count = 0;
+  for (const StubSymbol& symbol : symbols) {
+    name_offsets.push_back(appendString(&dynstr, symbol.name));
+    if (symbol.type == NdkSymbolType::variable) {
+      ++variable_count;
+    }
+  }
+
+  std::string shstrtab(1, '\0');
+  size_t section_names[section_count] = {};
+  section_names[shn_dynsym] = appendString(&shstrtab, ".dynsym");
+  section_names[shn_dynstr] = appendString(&shstrtab, ".dynstr");
+  section_names[shn_text] = appendString(&shstrtab, ".text");
+  section_names[shn_bss] = appendString(&shstrtab, ".bss");
+  section_names[shn_dynamic] = appendString(&shstrtab, ".dynamic");
+  section_names[shn_shstrtab] = appendString(&shstrtab, ".shstrtab");
+
+  size_t phdr_offset = sizeof(Elf_Ehdr);
+  size_t dynsym_offset = alignTo(phdr_offset + phdr_count * sizeof(Elf_Phdr), word_size);
+  size_t dynsym_size = (symbols.size() + 1) * sizeof(Elf_Sym);
+  size_t dynstr_offset = dynsym_offset + dynsym_size;
+  size_t text_offset = alignTo(dynstr_offset + dynstr.size(), 16);
+  size_t dynamic_offset = alignTo(text_offset, word_size);
+  size_t dynamic_size = dynamic_count * sizeof(Elf_Dyn);
+  size_t shstrtab_offset = dynamic_offset + dynamic_size;
+  size_t shdr_offset = alignTo(shstrtab_offset + shstrtab.size(), word_size);
+  size_t bss_address = alignTo(shstrtab_offset, 16);
+  size_t bss_size = variable_count * stub_variable_size;
+
+  std::vector<uint8_t> result(shdr_offset + section_count * sizeof(Elf_Shdr));
+  auto write = [&result](size_t offset, const void* data, size_t size) {
+    memcpy(result.data() + offset, data, size);
+  };
+
+  Elf_Ehdr ehdr = {};
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = target.elf_class;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_NONE;
+  ehdr.e_type = ET_DYN;
+  ehdr.e_machine = target.machine;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_phoff = phdr_offset;
+  ehdr.e_shoff = shdr_offset;
+  ehdr.e_flags = target.flags;
+  ehdr.e_ehsize = sizeof(Elf_Ehdr);
+  ehdr.e_phentsize = sizeof(Elf_Phdr);
+  ehdr.e_phnum = phdr_count;
+  ehdr.e_shentsize = sizeof(Elf_Shdr);
+  ehdr.e_shnum = section_count;
+  ehdr.e_shstrndx = shn_shstrtab;
+  write(0, &ehdr, sizeof(ehdr));
+
+  Elf_Phdr phdrs[phdr_count] = {};
+  phdrs[0].p_type = PT_LOAD;
+  phdrs[0].p_flags = PF_R | PF_W;
+  phdrs[0].p_filesz = shstrtab_offset;
+  phdrs[0].p_memsz = bss_address + bss_size;
+  phdrs[0].p_align = 0x1000;
+  phdrs[1].p_type = PT_DYNAMIC;
+  phdrs[1].p_flags = PF_R | PF_W;
+  phdrs[1].p_offset = phdrs[1].p_vaddr = phdrs[1].p_paddr = dynamic_offset;
+  phdrs[1].p_filesz = phdrs[1].p_memsz = dynamic_size;
+  phdrs[1].p_align = word_size;
+  write(phdr_offset, phdrs, sizeof(phdrs));
+
+  // Symbol 0 is the null symbol, which is already zeroed.
+  size_t next_variable = bss_address;
+  for (size_t i = 0; i < symbols.size(); ++i) {
+    Elf_Sym sym = {};
+    sym.st_name = name_offsets[i];
+    sym.st_other = STV_DEFAULT;
+    if (symbols[i].type == NdkSymbolType::function) {
+      sym.st_info = (STB_GLOBAL << 4) | STT_FUNC;
+      sym.st_shndx = shn_text;
+      sym.st_value = text_offset;
+    } else {
+      sym.st_info = (STB_GLOBAL << 4) | STT_OBJECT;
+      sym.st_shndx = shn_bss;
+      sym.st_value = next_variable;
+      sym.st_size = stub_variable_size;
+      next_variable += stub_variable_size;
+    }
+    write(dynsym_offset + (i + 1) * sizeof(Elf_Sym), &sym, sizeof(sym));
+  }
+
+  write(dynstr_offset, dynstr.data(), dynstr.size());
+
+  Elf_Dyn dynamic[dynamic_count] = {};
+  dynamic[0].d_tag = DT_SONAME;
+  dynamic[0].d_un.d_val = soname_offset;
+  dynamic[1].d_tag = DT_SYMTAB;
+  dynamic[1].d_un.d_ptr = dynsym_offset;
+  dynamic[2].d_tag = DT_STRTAB;
+  dynamic[2].d_un.d_ptr = dynstr_offset;
+  dynamic[3].d_tag = DT_STRSZ;
+  dynamic[3].d_un.d_val = dynstr.size();
+  dynamic[4].d_tag = DT_SYMENT;
+  dynamic[4].d_un.d_val = sizeof(Elf_Sym);
+  dynamic[5].d_tag = DT_NULL;
+  write(dynamic_offset, dynamic, sizeof(dynamic));
+
+  write(shstrtab_offset, shstrtab.data(), shstrtab.size());
+
+  Elf_Shdr shdrs[section_count] = {};
+  auto section = [&](SectionIndex index, uint32_t type, uint64_t flags, size_t offset, size_t size,
+                     size_t alignment) {
+    Elf_Shdr& shdr = shdrs[index];
+    shdr.sh_name = section_names[index];
+    shdr.sh_type = type;
+    shdr.sh_flags = flags;
+    shdr.sh_addr = (flags & SHF_ALLOC) ? offset : 0;
+    shdr.sh_offset = offset;
+    shdr.sh_size = size;
+    shdr.sh_addralign = alignment;
+    return &shdr;
+  };
+
+  Elf_Shdr* dynsym_shdr =
+    section(shn_dynsym, SHT_DYNSYM, SHF_ALLOC, dynsym_offset, dynsym_size, word_size);
+  dynsym_shdr->sh_link = shn_dynstr;
+  dynsym_shdr->sh_info = 1;
+  dynsym_shdr->sh_entsize = sizeof(Elf_Sym);
+
+  section(shn_dynstr, SHT_STRTAB, SHF_ALLOC, dynstr_offset, dynstr.size(), 1);
+  section(shn_text, SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR, text_offset, 0, 16);
+
+  Elf_Shdr* bss_shdr =
+    section(shn_bss, SHT_NOBITS, SHF_ALLOC | SHF_WRITE, shstrtab_offset, bss_size, 16);
+  bss_shdr->sh_addr = bss_address;
+
+  Elf_Shdr* dynamic_shdr = section(shn_dynamic, SHT_DYNAMIC, SHF_ALLOC | SHF_WRITE,
+                                   dynamic_offset, dynamic_size, word_size);
+  dynamic_shdr->sh_link = shn_dynstr;
+  dynamic_shdr->sh_entsize = sizeof(Elf_Dyn);
+
+  section(shn_shstrtab, SHT_STRTAB, 0, shstrtab_offset, shstrtab.size(), 1);
+  write(shdr_offset, shdrs, sizeof(shdrs));
+
+  return result;
+}
+
+void writeStubLibrary(const std::string& path, Arch arch, const std::string& soname,
+                      const std::vector<StubSymbol>& symbols) {
+  ElfTarget target = getElfTarget(arch);
+  std::vector<uint8_t> contents;
+  if (target.elf_class == ELFCLASS64) {
+    contents =
+      buildStub<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Sym, Elf64_Dyn>(target, soname, symbols);
+  } else {
+    contents =
+      buildStub<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Sym, Elf32_Dyn>(target, soname, symbols);
+  }
+
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    err(1, "failed to open '%s' for writing", path.c_str());
+  }
+
+  if (fwrite(contents.data(), 1, contents.size(), f) != contents.size() || fclose(f) != 0) {
+    err(1, "failed to write '%s'", path.c_str());
+  }
+}
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "FileCache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define VERSIONER_HAVE_IO_URING 1
+#endif
+#endif
+
+#include "Metrics.h"
+#include "Utils.h"
+#include "versioner.h"
+
+FileCache file_cache;
+
+// Opening and reading files on a network filesystem is bound by latency rather than CPU, so use
+// more threads than there are cores.
+static constexpr unsigned min_io_threads = 16;
+
+// The largest read to issue at once.
+static constexpr size_t max_read_size = 1 << 30;
+
+namespace {
+
+// A file that's being read into the cache.
+struct PendingRead {
+  const std::string* path;
+  int fd = -1;
+  std::unique_ptr<char[]> data;
+  size_t size = 0;
+  size_t done = 0;
+  bool failed = false;
+};
+
+}  // namespace
+
+#if defined(VERSIONER_HAVE_IO_URING)
+
+// A single io_uring submission and completion queue pair, used through the raw system calls so
+// that we don't depend on liburing.
+class IoUring {
+  int ring_fd = -1;
+  void* sq_ring = MAP_FAILED;
+  size_t sq_ring_size = 0;
+  void* cq_ring = MAP_FAILED;
+  size_t cq_ring_size = 0;
+  io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+  size_t sqes_size = 0;
+
+  unsigned sq_entries = 0;
+  unsigned* sq_tail = nullptr;
+  unsigned* sq_mask = nullptr;
+  unsigned* sq_array = nullptr;
+  unsigned* cq_head = nullptr;
+  unsigned* cq_tail = nullptr;
+  unsigned* cq_mask = nullptr;
+  io_uring_cqe* cqes = nullptr;
+
+  // Entries that have been queued, but not submitted yet.
+  unsigned unsubmitted = 0;
+
+ public:
+  IoUring() = default;
+  IoUring(const IoUring&) = delete;
+  IoUring& operator=(const IoUring&) = delete;
+
+  ~IoUring() {
+    if (sqes != MAP_FAILED) {
+      munmap(sqes, sqes_size);
+    }
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+      munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != MAP_FAILED) {
+      munmap(sq_ring, sq_ring_size);
+    }
+    if (ring_fd != -1) {
+      close(ring_fd);
+    }
+  }
+
+  // Set up the ring. Returns false if io_uring isn't available (e.g. on old kernels, or when it's
+  // disabled by a seccomp policy).
+  bool init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+      ring_fd = -1;
+      return false;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+      sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+      return false;
+    }
+
+    if (single_mmap) {
+      cq_ring = sq_ring;
+    } else {
+      cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     ring_fd, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED) {
+        return false;
+      }
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) {
+      return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring);
+    char* cq = static_cast<char*>(cq_ring);
+    sq_entries = params.sq_entries;
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  // The number of requests that may be in flight at once.
+  unsigned capacity() const {
+    return sq_entries;
+  }
+
+  void queueRead(int fd, char* buffer, size_t length, uint64_t offset, uint64_t user_data) {
+    unsigned tail = *sq_tail;
+    unsigned index = tail & *sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer);
+    sqe->len = length;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++unsubmitted;
+  }
+
+  // Submit everything that's been queued, and wait for at least one completion.
+  bool submitAndWait() {
+    while (true) {
+      long rc = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS,
+                        nullptr, 0);
+      if (rc >= 0) {
+        unsubmitted -= rc;
+        return true;
+      }
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+  }
+
+  bool popCompletion(uint64_t* user_data, int* result) {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+
+    const io_uring_cqe* cqe = &cqes[head & *cq_mask];
+    *user_data = cqe->user_data;
+    *result = cqe->res;
+    __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+  }
+};
+
+// Read as much as possible through a single io_uring. Returns false if io_uring is unavailable.
+// Anything that fails is left for readWithThreads to retry.
+static bool readWithIoUring(std::vector<PendingRead>& reads) {
+  IoUring ring;
+  if (!ring.init(256)) {
+    return false;
+  }
+
+  unsigned in_flight = 0;
+  auto queue = [&ring, &reads, &in_flight](size_t index) {
+    PendingRead& read = reads[index];
+    size_t length = std::min(read.size - read.done, max_read_size);
+    ring.queueRead(read.fd, read.data.get() + read.done, length, read.done, index);
+    ++in_flight;
+  };
+
+  size_t next = 0;
+  while (true) {
+    for (; next < reads.size() && in_flight < ring.capacity(); ++next) {
+      if (reads[next].fd != -1 && reads[next].done < reads[next].size) {
+        queue(next);
+      }
+    }
+
+    if (in_flight == 0) {
+      return true;
+    }
+
+    if (!ring.submitAndWait()) {
+      return true;
+    }
+
+    uint64_t index;
+    int result;
+    while (ring.popCompletion(&index, &result)) {
+      --in_flight;
+      PendingRead& read = reads[index];
+      if (result <= 0) {
+        // Leave errors (including kernels that don't know IORING_OP_READ) and early EOFs to the
+        // synchronous reads.
+        continue;
+      }
+
+      read.done += result;
+      if (read.done < read.size) {
+        queue(index);
+      }
+    }
+  }
+}
+
+#else
+
+static bool readWithIoUring(std::vector<PendingRead>&) {
+  return false;
+}
+
+#endif
+
+// Finish whatever hasn't been read yet with synchronous reads on a pool of threads.
+static void readWithThreads(std::vector<PendingRead>& reads, size_t thread_count) {
+  ParallelFor(reads.size(), [&reads](size_t i) {
+    PendingRead& read = reads[i];
+    while (read.fd != -1 && read.done < read.size) {
+      ssize_t rc = pread(read.fd, read.data.get() + read.done, read.size - read.done, read.done);
+      if (rc < 0 && errno == EINTR) {
+        continue;
+      } else if (rc < 0) {
+        read.failed = true;
+        break;
+      } else if (rc == 0) {
+        // The file was truncated after we looked at it.
+        read.size = read.done;
+        read.data[read.size] = '\0';
+        break;
+      }
+      read.done += rc;
+    }
+  }, thread_count);
+}
+
+void FileCache::prefetch(const std::vector<std::string>& paths) {
+  PhaseTimer phase_timer("prefetch");
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<PendingRead> reads;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_set<std::string> seen;
+    for (const std::string& path : paths) {
+      if (files.count(path) == 0 && missing.count(path) == 0 && seen.insert(path).second) {
+        reads.emplace_back();
+        reads.back().path = &path;
+      }
+    }
+  }
+
+  if (reads.empty()) {
+    return;
+  }
+
+  size_t thread_count = std::max(min_io_threads, std::thread::hardware_concurrency());
+  ParallelFor(reads.size(), [&reads](size_t i) {
+    PendingRead& read = reads[i];
+    int fd = open(read.path->c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+      close(fd);
+      return;
+    }
+
+    read.fd = fd;
+    read.size = st.st_size;
+    read.data.reset(new char[read.size + 1]);
+    read.data[read.size] = '\0';
+  }, thread_count);
+
+  bool used_io_uring = readWithIoUring(reads);
+  readWithThreads(reads, thread_count);
+
+  size_t bytes = 0;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (PendingRead& read : reads) {
+    if (read.fd == -1 || read.failed) {
+      missing.insert(*read.path);
+    } else {
+      bytes += read.size;
+      files[*read.path] = { std::move(read.data), read.size };
+    }
+
+    if (read.fd != -1) {
+      close(read.fd);
+    }
+  }
+  total_bytes += bytes;
+
+  if (verbose) {
+    auto duration = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "prefetched %zu files (%zu KB) in %lld ms using %s\n", reads.size(),
+            bytes >> 10,
+            static_cast<long long>(
+              std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()),
+            used_io_uring ? "io_uring" : "threads");
+  }
+}
+
+bool FileCache::find(const std::string& path, llvm::StringRef* contents) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = files.find(path);
+  if (it == files.end()) {
+    ++miss_count;
+    return false;
+  }
+
+  ++hit_count;
+  *contents = llvm::StringRef(it->second.data.get(), it->second.size);
+  return true;
+}
+
+bool FileCache::isMissing(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return missing.count(path) != 0;
+}
+
+void FileCache::clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+  files.clear();
+  missing.clear();
+  total_bytes = 0;
+}
+
+size_t FileCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return files.size();
+}
+
+uint64_t FileCache::totalBytes() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return total_bytes;
+}
+
+uint64_t FileCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return hit_count;
+}
+
+uint64_t FileCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return miss_count;
+}
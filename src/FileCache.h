@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+// The contents of files that were read ahead of time, so that the rest of the pipeline doesn't
+// block on a slow filesystem one open/read/stat at a time. Files are read in batches through
+// io_uring where the kernel supports it, and by a pool of threads otherwise.
+//
+// Everything that reads an input file (headers and their dependencies, the platform symbol lists,
+// the device libraries) checks the cache first, and falls back to the filesystem on a miss.
+class FileCache {
+  struct File {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  mutable std::mutex mutex;
+  std::unordered_map<std::string, File> files;
+
+  // Paths that were prefetched, but couldn't be opened or aren't regular files.
+  std::unordered_set<std::string> missing;
+
+  uint64_t total_bytes = 0;
+
+  // Lookups that found the file in the cache, and those that didn't.
+  mutable uint64_t hit_count = 0;
+  mutable uint64_t miss_count = 0;
+
+ public:
+  // Read every file in paths that isn't cached yet. Paths are cached exactly as given, and must be
+  // looked up the same way.
+  void prefetch(const std::vector<std::string>& paths);
+
+  // Get the contents of a cached file. The contents are followed by a NUL byte, and remain valid
+  // until the cache is cleared.
+  bool find(const std::string& path, llvm::StringRef* contents) const;
+
+  // Whether path was prefetched, and found not to be a readable file.
+  bool isMissing(const std::string& path) const;
+
+  // Drop everything, e.g. when the inputs may have changed. Nothing else may use the cache
+  // concurrently.
+  void clear();
+
+  size_t size() const;
+  uint64_t totalBytes() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+};
+
+extern FileCache file_cache;
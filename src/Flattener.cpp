@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Flattener.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "Annotator.h"
+#include "FileCache.h"
+#include "Metrics.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using llvm::StringRef;
+
+// A span of a header, as [begin, end) offsets, to leave out of a flattened copy of it.
+using Removal = std::pair<unsigned, unsigned>;
+
+// A declaration that isn't available for some type, and the symbol that it declares.
+struct UnavailableDeclaration {
+  const std::string* symbol_name;
+  const DeclarationLocation* location;
+};
+
+// A declaration that couldn't be found in its header, and the types that it was unavailable in.
+struct UnlocatableDeclaration {
+  const DeclarationLocation* location;
+  std::vector<CompilationType> types;
+};
+
+static bool isAvailable(const DeclarationAvailability& availability, int api_level) {
+  if (availability.introduced != 0 && api_level < availability.introduced) {
+    return false;
+  }
+  return availability.obsoleted == 0 || api_level < availability.obsoleted;
+}
+
+static std::string getIncludeDir(const std::string& output_dir, const CompilationType& type) {
+  return output_dir + "/platforms/android-" + std::to_string(type.api_level) + "/arch-" +
+         type.arch + "/usr/include";
+}
+
+// Find what to remove for a declaration: everything from its start to its semicolon (or to the end
+// of its body, if it's a definition), widened to whole lines if nothing else is on them.
+static bool getRemoval(StringRef contents, const DeclarationLocation& location, Removal* result) {
+  unsigned start = location.start_offset;
+  unsigned end = location.end_offset;
+  if (end == 0 || start >= end || end > contents.size()) {
+    return false;
+  }
+
+  if (!location.is_definition) {
+    unsigned terminator;
+    if (!findTerminator(contents, end, &terminator)) {
+      return false;
+    }
+    end = terminator + 1;
+  }
+
+  size_t next = contents.find_first_not_of(" \t", end);
+  size_t previous = contents.find_last_not_of(" \t", start);
+  bool ends_line = next == StringRef::npos || contents[next] == '\n';
+  bool starts_line = previous == StringRef::npos || contents[previous] == '\n';
+  if (starts_line && ends_line) {
+    start = previous == StringRef::npos ? 0 : previous + 1;
+    end = next == StringRef::npos ? contents.size() : next + 1;
+  }
+
+  *result = Removal(start, end);
+  return true;
+}
+
+// Sort removals and merge the ones that overlap, e.g. several declarators in one declaration.
+static void normalizeRemovals(std::vector<Removal>* removals) {
+  std::sort(removals->begin(), removals->end());
+  std::vector<Removal> merged;
+  for (const Removal& removal : *removals) {
+    if (!merged.empty() && removal.first <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, removal.second);
+    } else {
+      merged.push_back(removal);
+    }
+  }
+  *removals = std::move(merged);
+}
+
+static std::string applyRemovals(StringRef contents, const std::vector<Removal>& removals) {
+  std::string result;
+  result.reserve(contents.size());
+  size_t copied = 0;
+  for (const Removal& removal : removals) {
+    result.append(contents.data() + copied, removal.first - copied);
+    copied = removal.second;
+  }
+  result.append(contents.data() + copied, contents.size() - copied);
+  return result;
+}
+
+// Remove whatever is at path, so that writing to it doesn't write through a hardlink left there by
+// a previous run.
+static void removeExisting(const std::string& path) {
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    err(1, "failed to remove '%s'", path.c_str());
+  }
+}
+
+static void writeFile(const std::string& path, const std::string& contents) {
+  removeExisting(path);
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    err(1, "failed to open '%s' for writing", path.c_str());
+  }
+  if (fwrite(contents.data(), 1, contents.size(), f) != contents.size() || fclose(f) != 0) {
+    err(1, "failed to write '%s'", path.c_str());
+  }
+}
+
+bool flattenHeaders(const std::set<CompilationType>& types,
+                    const DeclarationDatabase& declaration_database, const std::string& header_dir,
+                    const std::string& output_dir, DiagnosticSink& sink) {
+  PhaseTimer phase_timer("flatten");
+  std::vector<std::string> headers = collectFiles(header_dir);
+  std::map<std::string, size_t> header_indices;
+  for (size_t i = 0; i < headers.size(); ++i) {
+    header_indices[getRelativePath(headers[i], header_dir)] = i;
+  }
+
+  // For each header, map from type to the declarations in it that aren't available in that type.
+  std::vector<std::map<CompilationType, std::vector<UnavailableDeclaration>>> unavailable(
+    headers.size());
+  for (const auto& it : declaration_database) {
+    for (const DeclarationRange& range : it.second.getRanges()) {
+      std::vector<CompilationType> range_types;
+      for (const DeclarationLocation& location : range.declaration->locations) {
+        // Removals are made from the file that the offsets are into. If they're unknown, fall back
+        // to the presumed file, so that the failure to locate the declaration gets reported.
+        const std::string& filename =
+          location.offset_filename.empty() ? location.filename : location.offset_filename;
+        if (location.availability.empty() || !StartsWith(filename, header_dir)) {
+          continue;
+        }
+
+        auto header_it = header_indices.find(getRelativePath(filename, header_dir));
+        if (header_it == header_indices.end()) {
+          continue;
+        }
+
+        if (range_types.empty()) {
+          range_types = declaration_database.expand(range);
+        }
+
+        for (const CompilationType& type : range_types) {
+          if (types.count(type) != 0 && !isAvailable(location.availability, type.api_level)) {
+            unavailable[header_it->second][type].push_back({ &it.first, &location });
+          }
+        }
+      }
+    }
+  }
+
+  // Create every directory up front, so that the workers only have to write files.
+  std::set<std::string> relative_dirs = { "" };
+  for (const auto& it : header_indices) {
+    size_t separator = it.first.rfind('/');
+    if (separator != std::string::npos) {
+      relative_dirs.insert("/" + it.first.substr(0, separator));
+    }
+  }
+  for (const CompilationType& type : types) {
+    std::string include_dir = getIncludeDir(output_dir, type);
+    for (const std::string& relative_dir : relative_dirs) {
+      makeDirectories(include_dir + relative_dir);
+    }
+  }
+
+  // For each header, the declarations that couldn't be located, by symbol and line.
+  std::vector<std::map<std::pair<std::string, unsigned>, UnlocatableDeclaration>> failures(
+    headers.size());
+  std::atomic<size_t> files_written(0);
+  std::atomic<size_t> files_linked(0);
+  ParallelFor(headers.size(), [&](size_t i) {
+    const std::string& header = headers[i];
+    std::string relative_path = getRelativePath(header, header_dir);
+
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    StringRef contents;
+    if (!file_cache.find(header, &contents)) {
+      auto result = llvm::MemoryBuffer::getFile(header);
+      if (std::error_code ec = result.getError()) {
+        errx(1, "failed to read header '%s': %s", header.c_str(), ec.message().c_str());
+      }
+      buffer = std::move(result.get());
+      contents = buffer->getBuffer();
+    }
+
+    // Group the types by what has to be removed for them, so that each distinct copy of the header
+    // is only produced once. Usually that's a handful of copies for dozens of types.
+    std::map<std::vector<Removal>, std::vector<const CompilationType*>> copies;
+    for (const CompilationType& type : types) {
+      std::vector<Removal> removals;
+      auto it = unavailable[i].find(type);
+      if (it != unavailable[i].end()) {
+        for (const UnavailableDeclaration& declaration : it->second) {
+          Removal removal;
+          if (!getRemoval(contents, *declaration.location, &removal)) {
+            UnlocatableDeclaration& failure =
+              failures[i][{ *declaration.symbol_name, declaration.location->line_number }];
+            failure.location = declaration.location;
+            failure.types.push_back(type);
+            continue;
+          }
+          removals.push_back(removal);
+        }
+        normalizeRemovals(&removals);
+      }
+      copies[std::move(removals)].push_back(&type);
+    }
+
+    for (const auto& copy : copies) {
+      std::string result = applyRemovals(contents, copy.first);
+      std::string first_path;
+      for (const CompilationType* type : copy.second) {
+        std::string path = getIncludeDir(output_dir, *type) + "/" + relative_path;
+        if (!first_path.empty()) {
+          removeExisting(path);
+          if (link(first_path.c_str(), path.c_str()) == 0) {
+            ++files_linked;
+            continue;
+          }
+        }
+
+        // Either this is the first tree to need this copy, or the filesystem can't link to it.
+        writeFile(path, result);
+        ++files_written;
+        if (first_path.empty()) {
+          first_path = path;
+        }
+      }
+    }
+  });
+
+  bool failed = false;
+  for (const auto& header_failures : failures) {
+    for (const auto& it : header_failures) {
+      const DeclarationLocation* location = it.second.location;
+      Diagnostic diagnostic;
+      diagnostic.code = DiagnosticCode::unlocatable_declaration;
+      diagnostic.symbol = it.first.first;
+      diagnostic.message =
+        "unable to locate the declaration, so it can't be removed from the flattened headers";
+      diagnostic.filename = location->filename;
+      diagnostic.line_number = location->line_number;
+      diagnostic.types = it.second.types;
+
+      Declaration declaration;
+      declaration.name = it.first.first;
+      declaration.locations = { *location };
+      diagnostic.declarations = { std::move(declaration) };
+      sink.report(std::move(diagnostic));
+      failed = true;
+    }
+  }
+
+  if (verbose) {
+    fprintf(stderr, "flattened %zu headers for %zu compilation types into '%s'\n", headers.size(),
+            types.size(), output_dir.c_str());
+    fprintf(stderr, "  %zu files written, %zu hardlinked\n", files_written.load(),
+            files_linked.load());
+  }
+  return !failed;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Generator.h"
+
+#include <err.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ElfWriter.h"
+#include "Metrics.h"
+#include "SymbolDatabase.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace std::string_literals;
+
+struct LibraryHeader {
+  const char* header;
+  const char* library;
+};
+
+// Headers whose declarations aren't implemented by libc.
+static constexpr LibraryHeader library_headers[] = {
+  { "complex.h", "libm.so" },
+  { "dlfcn.h", "libdl.so" },
+  { "fenv.h", "libm.so" },
+  { "math.h", "libm.so" },
+};
+
+static constexpr const char* generated_libraries[] = { "libc.so", "libdl.so", "libm.so" };
+
+static const char* getLibrary(const Declaration& declaration) {
+  const std::string& filename = declaration.locations.begin()->filename;
+  for (const LibraryHeader& entry : library_headers) {
+    if (EndsWith(filename, "/"s + entry.header)) {
+      return entry.library;
+    }
+  }
+  return "libc.so";
+}
+
+static void writeSymbolList(const std::string& path, const std::vector<StubSymbol>& symbols,
+                            NdkSymbolType type) {
+  FILE* f = fopen(path.c_str(), "w");
+  if (!f) {
+    err(1, "failed to open '%s' for writing", path.c_str());
+  }
+
+  for (const StubSymbol& symbol : symbols) {
+    if (symbol.type == type) {
+      fprintf(f, "%s\n", symbol.name.c_str());
+    }
+  }
+
+  if (fclose(f) != 0) {
+    err(1, "failed to write '%s'", path.c_str());
+  }
+}
+
+void generatePlatform(const std::set<CompilationType>& types,
+                      const DeclarationDatabase& declaration_database,
+                      const std::string& output_dir) {
+  PhaseTimer phase_timer("generate");
+  std::vector<CompilationType> type_list(types.begin(), types.end());
+  std::atomic<size_t> symbol_count(0);
+  ParallelFor(type_list.size(), [&](size_t i) {
+    const CompilationType& type = type_list[i];
+
+    // Map from library to the symbols that it needs to export, in name order.
+    std::map<std::string, std::vector<StubSymbol>> libraries;
+    for (const char* library : generated_libraries) {
+      libraries[library];
+    }
+
+    for (const auto& it : declaration_database) {
+      const Declaration* declaration = it.second.find(type);
+      if (!declaration || !declaration->needsLinking(type.api_level)) {
+        continue;
+      }
+
+      switch (declaration->type()) {
+        case DeclarationType::function:
+          libraries[getLibrary(*declaration)].push_back({ it.first, NdkSymbolType::function });
+          break;
+
+        case DeclarationType::variable:
+          libraries[getLibrary(*declaration)].push_back({ it.first, NdkSymbolType::variable });
+          break;
+
+        case DeclarationType::inconsistent:
+          // sanityCheck reports these.
+          break;
+      }
+    }
+
+    std::string level_dir = "android-" + std::to_string(type.api_level);
+    std::string symbols_dir = output_dir + "/platforms/" + level_dir + "/arch-" + type.arch +
+                              "/symbols";
+    std::string stubs_dir = output_dir + "/stubs/" + type.arch + "/" + level_dir + "/usr/lib";
+    makeDirectories(symbols_dir);
+    makeDirectories(stubs_dir);
+
+    for (const auto& library : libraries) {
+      const std::string& name = library.first;
+      writeSymbolList(symbols_dir + "/" + name + ".functions.txt", library.second,
+                      NdkSymbolType::function);
+      writeSymbolList(symbols_dir + "/" + name + ".variables.txt", library.second,
+                      NdkSymbolType::variable);
+      writeStubLibrary(stubs_dir + "/" + name, findArch(type.arch)->arch, name, library.second);
+      symbol_count += library.second.size();
+    }
+  });
+
+  if (verbose) {
+    fprintf(stderr, "generated %zu symbols for %zu compilation types in '%s'\n",
+            symbol_count.load(), type_list.size(), output_dir.c_str());
+  }
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Metrics.h"
+
+#include <err.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "FileCache.h"
+
+RunMetrics run_metrics;
+
+void RunMetrics::recordPhase(const std::string& phase,
+                             std::chrono::steady_clock::duration duration) {
+  std::lock_guard<std::mutex> lock(mutex);
+  phase_us[phase] += std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+}
+
+void RunMetrics::recordCompilation(const CompilationType& type, size_t translation_units,
+                                   size_t headers, uint64_t duration_us) {
+  std::lock_guard<std::mutex> lock(mutex);
+  TypeMetrics& metrics = types[type];
+  metrics.translation_units += translation_units;
+  metrics.headers += headers;
+  metrics.parse_us += duration_us;
+}
+
+void RunMetrics::add(RunCounter counter, uint64_t value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  counters[counter] += value;
+}
+
+void RunMetrics::raise(RunCounter counter, uint64_t value) {
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t& current = counters[counter];
+  current = std::max(current, value);
+}
+
+static double toSeconds(uint64_t us) {
+  return us / 1e6;
+}
+
+static double toSeconds(const struct timeval& tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double ratio(uint64_t numerator, uint64_t denominator) {
+  return denominator == 0 ? 0 : static_cast<double>(numerator) / denominator;
+}
+
+static void writeHeader(FILE* f, const char* name, const char* type, const char* help) {
+  fprintf(f, "# HELP %s %s\n", name, help);
+  fprintf(f, "# TYPE %s %s\n", name, type);
+}
+
+static void writeMetric(FILE* f, const char* name, const char* type, const char* help,
+                        double value) {
+  writeHeader(f, name, type, help);
+  fprintf(f, "%s %.15g\n", name, value);
+}
+
+// Write a metric with one sample per entry of values, distinguished by a label.
+template <typename Map, typename Key, typename Value>
+static void writeLabeled(FILE* f, const char* name, const char* type, const char* help,
+                         const char* label, const Map& values, Key key, Value value) {
+  writeHeader(f, name, type, help);
+  for (const auto& it : values) {
+    std::string label_value = key(it.first);
+    fprintf(f, "%s{%s=\"%s\"} %.15g\n", name, label, label_value.c_str(),
+            static_cast<double>(value(it.second)));
+  }
+}
+
+void RunMetrics::write(const std::string& path) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto counter = [this](RunCounter c) -> uint64_t {
+    auto it = counters.find(c);
+    return it == counters.end() ? 0 : it->second;
+  };
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    err(1, "getrusage failed");
+  }
+
+  uint64_t headers_parsed = 0;
+  for (const auto& it : types) {
+    headers_parsed += it.second.headers;
+  }
+
+  uint64_t cache_hits = file_cache.hits();
+  uint64_t cache_misses = file_cache.misses();
+  auto run_time = std::chrono::steady_clock::now() - start;
+
+  // Write to a temporary file and rename it into place, so that a scraper never sees a partial
+  // file.
+  std::string tmp_path = path + ".tmp";
+  FILE* f = fopen(tmp_path.c_str(), "w");
+  if (!f) {
+    err(1, "failed to open metrics file '%s' for writing", tmp_path.c_str());
+  }
+
+  writeMetric(f, "versioner_run_seconds", "gauge", "Wall time of the whole run.",
+              std::chrono::duration<double>(run_time).count());
+  writeMetric(f, "versioner_cpu_seconds", "gauge", "User and system CPU time of the whole run.",
+              toSeconds(usage.ru_utime) + toSeconds(usage.ru_stime));
+  // ru_maxrss is in kilobytes on Linux.
+  writeMetric(f, "versioner_peak_resident_bytes", "gauge", "Peak resident set size.",
+              static_cast<double>(usage.ru_maxrss) * 1024);
+  writeLabeled(f, "versioner_phase_seconds", "gauge",
+               "Wall time of each phase. Phases may overlap.", "phase", phase_us,
+               [](const std::string& phase) { return phase; },
+               [](uint64_t us) { return toSeconds(us); });
+
+  writeLabeled(f, "versioner_translation_units_total", "counter",
+               "Translation units parsed for each type, including the C++ ones.", "type", types,
+               [](const CompilationType& type) { return type.describe(); },
+               [](const TypeMetrics& metrics) { return metrics.translation_units; });
+  writeLabeled(f, "versioner_compiled_headers_total", "counter",
+               "Headers compiled for each type. A C++ umbrella unit counts as one.", "type", types,
+               [](const CompilationType& type) { return type.describe(); },
+               [](const TypeMetrics& metrics) { return metrics.headers; });
+  writeLabeled(f, "versioner_parse_seconds_total", "counter",
+               "Time spent parsing the headers of each type, summed across threads.", "type",
+               types, [](const CompilationType& type) { return type.describe(); },
+               [](const TypeMetrics& metrics) { return toSeconds(metrics.parse_us); });
+  writeMetric(f, "versioner_headers_parsed_total", "counter",
+              "Headers compiled, counted once per type that they were compiled for.",
+              headers_parsed);
+  writeMetric(f, "versioner_headers_reused_total", "counter",
+              "Headers that were skipped because they're unchanged from the baseline.",
+              counter(RunCounter::headers_reused));
+
+  uint64_t busy_us = counter(RunCounter::compile_thread_busy_us);
+  writeMetric(f, "versioner_compile_thread_busy_seconds", "gauge",
+              "Time that compilation threads spent compiling.", toSeconds(busy_us));
+  writeMetric(f, "versioner_compile_thread_utilization", "gauge",
+              "Fraction of the compilation threads' wall time spent compiling.",
+              ratio(busy_us, counter(RunCounter::compile_thread_capacity_us)));
+  writeMetric(f, "versioner_peak_compilations", "gauge",
+              "Most compilations that ran at once.", counter(RunCounter::peak_compilations));
+  writeMetric(f, "versioner_types_transposed_early_total", "counter",
+              "Compiled types transposed while other compilations were still running.",
+              counter(RunCounter::types_transposed_early));
+
+  writeMetric(f, "versioner_symbols", "gauge", "Symbols declared by the headers.",
+              counter(RunCounter::symbols));
+  writeMetric(f, "versioner_declaration_ranges", "gauge",
+              "Ranges of types with the same declaration of a symbol.",
+              counter(RunCounter::declaration_ranges));
+  writeMetric(f, "versioner_distinct_declarations", "gauge",
+              "Distinct declarations of the symbols.", counter(RunCounter::distinct_declarations));
+  writeMetric(f, "versioner_platform_symbols", "gauge", "Symbols in the NDK platform.",
+              counter(RunCounter::platform_symbols));
+
+  writeMetric(f, "versioner_file_cache_hits_total", "counter",
+              "Input file reads served from the prefetched file cache.", cache_hits);
+  writeMetric(f, "versioner_file_cache_misses_total", "counter",
+              "Input file reads that weren't in the prefetched file cache.", cache_misses);
+  writeMetric(f, "versioner_file_cache_hit_ratio", "gauge",
+              "Fraction of input file reads served from the prefetched file cache.",
+              ratio(cache_hits, cache_hits + cache_misses));
+  writeMetric(f, "versioner_names_mangled_total", "counter",
+              "Declaration names that had to be mangled (name cache misses).",
+              counter(RunCounter::names_mangled));
+  writeMetric(f, "versioner_mangles_avoided_total", "counter",
+              "Redeclarations that reused a mangled name (name cache hits).",
+              counter(RunCounter::mangles_avoided));
+
+  if (fclose(f) != 0) {
+    err(1, "failed to write metrics file '%s'", tmp_path.c_str());
+  }
+
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    err(1, "failed to rename '%s' to '%s'", tmp_path.c_str(), path.c_str());
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "DeclarationDatabase.h"
+
+// Run-wide totals. Don't rename these, since dashboards are keyed on the exported names.
+enum class RunCounter {
+  headers_reused,
+  names_mangled,
+  mangles_avoided,
+  compile_thread_busy_us,
+  compile_thread_capacity_us,
+  peak_compilations,
+  symbols,
+  declaration_ranges,
+  distinct_declarations,
+  platform_symbols,
+  types_transposed_early,
+};
+
+// Numbers describing a run, for tracking its performance over time. Everything is recorded as the
+// run goes, and written out at the end if it was asked for (-M), in the Prometheus text format.
+class RunMetrics {
+  struct TypeMetrics {
+    uint64_t translation_units = 0;
+    uint64_t headers = 0;
+    uint64_t parse_us = 0;
+  };
+
+  mutable std::mutex mutex;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::map<std::string, uint64_t> phase_us;
+  std::map<CompilationType, TypeMetrics> types;
+  std::map<RunCounter, uint64_t> counters;
+
+ public:
+  // Add the wall time of a phase. Phases can overlap, and repeated phases accumulate.
+  void recordPhase(const std::string& phase, std::chrono::steady_clock::duration duration);
+
+  // Record a compilation job for type, which parsed headers in translation_units, taking
+  // duration_us between them.
+  void recordCompilation(const CompilationType& type, size_t translation_units, size_t headers,
+                         uint64_t duration_us);
+
+  void add(RunCounter counter, uint64_t value);
+
+  // Keep the largest value seen, for counters that are high-water marks.
+  void raise(RunCounter counter, uint64_t value);
+
+  // Write everything recorded so far to path, exiting on failure.
+  void write(const std::string& path) const;
+};
+
+extern RunMetrics run_metrics;
+
+// Adds the wall time of its scope to a phase of run_metrics.
+class PhaseTimer {
+  std::string phase;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  explicit PhaseTimer(std::string phase)
+      : phase(std::move(phase)), start(std::chrono::steady_clock::now()) {
+  }
+
+  ~PhaseTimer() {
+    run_metrics.recordPhase(phase, std::chrono::steady_clock::now() - start);
+  }
+
+  PhaseTimer(const PhaseTimer&) = delete;
+  PhaseTimer& operator=(const PhaseTimer&) = delete;
+};
@@ -0,0 +1,531 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Prescan.h"
+
+#include <ctype.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "clang/Basic/LangOptions.h"
+#include "clang/Basic/SourceLocation.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/Token.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "Metrics.h"
+#include "Utils.h"
+#include "versioner.h"
+
+using namespace clang;
+using namespace std::string_literals;
+
+struct ScannedToken {
+  tok::TokenKind kind;
+  StringRef text;
+  unsigned offset;
+  bool at_start_of_line;
+};
+
+struct ScannedDeclaration {
+  std::string name;
+  std::string filename;
+  unsigned line_number;
+  DeclarationType type;
+
+  // Availability, as determined by __INTRODUCED_IN and friends, and by enclosing
+  // #if __ANDROID_API__ >= N guards. Zero means unspecified.
+  int introduced_32 = 0;
+  int introduced_64 = 0;
+  int obsoleted = 0;
+  bool future = false;
+};
+
+// The state of a preprocessor conditional that we're inside of.
+struct ScannedGuard {
+  int introduced;
+  bool skip;
+  bool api_guard;
+};
+
+static std::vector<ScannedToken> lexBuffer(StringRef buffer) {
+  LangOptions lang_opts;
+  lang_opts.C11 = true;
+  lang_opts.GNUMode = true;
+  lang_opts.LineComment = true;
+
+  // Token locations are offsets from this fake location, as in Lexer::ComputePreamble.
+  SourceLocation base = SourceLocation::getFromRawEncoding(1);
+  Lexer lexer(base, lang_opts, buffer.begin(), buffer.begin(), buffer.end());
+
+  std::vector<ScannedToken> result;
+  Token token;
+  while (true) {
+    lexer.LexFromRawLexer(token);
+    if (token.is(tok::eof)) {
+      break;
+    }
+
+    unsigned offset = token.getLocation().getRawEncoding() - base.getRawEncoding();
+    ScannedToken scanned = {
+      .kind = token.getKind(),
+      .text = buffer.substr(offset, token.getLength()),
+      .offset = offset,
+      .at_start_of_line = token.isAtStartOfLine(),
+    };
+    result.push_back(scanned);
+  }
+  return result;
+}
+
+static bool isKeyword(StringRef text) {
+  static const std::set<std::string> keywords = {
+    "_Bool", "_Noreturn", "char", "const", "double", "enum", "extern", "float", "int", "long",
+    "restrict", "__restrict", "short", "signed", "struct", "union", "unsigned", "void", "volatile",
+  };
+  return keywords.count(text.str()) != 0;
+}
+
+// Macros that take arguments and are never the name being declared: attributes, and everything
+// that looks like __SOME_MACRO.
+static bool isAttributeMacro(StringRef text) {
+  static const std::set<std::string> attributes = {
+    "__asm__", "__asm", "asm", "__printflike", "__scanflike", "__nonnull", "__strftimelike",
+    "__format_arg", "__aligned", "__section", "__errorattr", "__warnattr", "__errordecl",
+    "__overloadable", "_Alignas", "__typeof__", "typeof",
+  };
+
+  if (text.startswith("__attribute") || attributes.count(text.str()) != 0) {
+    return true;
+  }
+
+  if (!text.startswith("__") || text.size() <= 2) {
+    return false;
+  }
+
+  for (char c : text.substr(2)) {
+    if (!(isupper(c) || isdigit(c) || c == '_')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Find the index of the parenthesis that closes the one at index open.
+static size_t findClosingParen(const std::vector<const ScannedToken*>& tokens, size_t open) {
+  int depth = 0;
+  for (size_t i = open; i < tokens.size(); ++i) {
+    if (tokens[i]->kind == tok::l_paren) {
+      ++depth;
+    } else if (tokens[i]->kind == tok::r_paren) {
+      if (--depth == 0) {
+        return i;
+      }
+    }
+  }
+  return tokens.size() - 1;
+}
+
+// Parse an availability macro invocation, returning false if name isn't one.
+static bool parseAnnotation(StringRef name, const std::vector<const ScannedToken*>& tokens,
+                            size_t open, size_t close, ScannedDeclaration* declaration) {
+  int* target;
+  if (name == "__INTRODUCED_IN") {
+    target = nullptr;
+  } else if (name == "__INTRODUCED_IN_32") {
+    target = &declaration->introduced_32;
+  } else if (name == "__INTRODUCED_IN_64") {
+    target = &declaration->introduced_64;
+  } else if (name == "__REMOVED_IN") {
+    target = &declaration->obsoleted;
+  } else if (name == "__DEPRECATED_IN") {
+    return true;
+  } else {
+    return false;
+  }
+
+  // We only understand a single literal argument.
+  if (close != open + 2 || tokens[open + 1]->kind != tok::numeric_constant) {
+    return true;
+  }
+
+  int value = strtol(tokens[open + 1]->text.str().c_str(), nullptr, 10);
+  if (target) {
+    *target = value;
+  } else {
+    declaration->introduced_32 = value;
+    declaration->introduced_64 = value;
+  }
+  return true;
+}
+
+class HeaderScanner {
+  std::string filename;
+  std::vector<ScannedToken> tokens;
+  std::vector<unsigned> line_starts;
+  std::vector<ScannedGuard> guards;
+  std::vector<ScannedDeclaration>& output;
+
+  unsigned lineNumber(unsigned offset) const {
+    return std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin();
+  }
+
+  void handleDirective(size_t begin, size_t end) {
+    if (begin == end) {
+      return;
+    }
+
+    StringRef directive = tokens[begin].text;
+    if (directive == "if") {
+      ScannedGuard guard = { .introduced = 0, .skip = false, .api_guard = false };
+      if (end - begin == 4 && tokens[begin + 1].text == "__ANDROID_API__" &&
+          tokens[begin + 3].kind == tok::numeric_constant) {
+        int level = strtol(tokens[begin + 3].text.str().c_str(), nullptr, 10);
+        if (tokens[begin + 2].kind == tok::greaterequal) {
+          guard = { .introduced = level, .skip = false, .api_guard = true };
+        } else if (tokens[begin + 2].kind == tok::greater) {
+          guard = { .introduced = level + 1, .skip = false, .api_guard = true };
+        }
+      } else if (end - begin == 2 && tokens[begin + 1].text == "0") {
+        guard.skip = true;
+      }
+      guards.push_back(guard);
+    } else if (directive == "ifdef" || directive == "ifndef") {
+      guards.push_back({ .introduced = 0, .skip = false, .api_guard = false });
+    } else if (directive == "elif" || directive == "else") {
+      // The other side of an __ANDROID_API__ guard is for older API levels, which we can't
+      // reason about without a preprocessor, so skip it entirely.
+      if (!guards.empty()) {
+        guards.back().introduced = 0;
+        guards.back().skip = guards.back().api_guard;
+      }
+    } else if (directive == "endif") {
+      if (!guards.empty()) {
+        guards.pop_back();
+      }
+    }
+  }
+
+  void handleStatement(const std::vector<const ScannedToken*>& statement) {
+    if (statement.empty()) {
+      return;
+    }
+
+    ScannedDeclaration declaration;
+    bool is_extern = false;
+    bool declarator_done = false;
+    const ScannedToken* function_name = nullptr;
+    const ScannedToken* variable_name = nullptr;
+
+    for (size_t i = 0; i < statement.size(); ++i) {
+      const ScannedToken* token = statement[i];
+      if (token->kind == tok::raw_identifier) {
+        StringRef text = token->text;
+        if (text == "typedef" || text == "static" || text == "inline" || text == "__inline" ||
+            text == "__inline__") {
+          return;
+        } else if (text == "extern") {
+          is_extern = true;
+          continue;
+        } else if (text == "__INTRODUCED_IN_FUTURE") {
+          declaration.future = true;
+          continue;
+        }
+
+        bool invocation = i + 1 < statement.size() && statement[i + 1]->kind == tok::l_paren;
+        size_t close = invocation ? findClosingParen(statement, i + 1) : i;
+        if (invocation && parseAnnotation(text, statement, i + 1, close, &declaration)) {
+          i = close;
+          continue;
+        }
+
+        if (isAttributeMacro(text)) {
+          i = close;
+          continue;
+        }
+
+        if (isKeyword(text)) {
+          continue;
+        }
+
+        if (invocation) {
+          if (!declarator_done && !function_name) {
+            function_name = token;
+          }
+          declarator_done = true;
+          i = close;
+          continue;
+        }
+
+        if (!declarator_done) {
+          variable_name = token;
+        }
+      } else if (token->kind == tok::l_paren) {
+        // Parenthesized declarators (e.g. function pointers) are beyond what we handle here.
+        if (!declarator_done) {
+          return;
+        }
+        i = findClosingParen(statement, i);
+      } else if (token->kind == tok::l_square || token->kind == tok::equal ||
+                 token->kind == tok::colon || token->kind == tok::comma) {
+        declarator_done = true;
+      }
+    }
+
+    const ScannedToken* name;
+    if (function_name) {
+      name = function_name;
+      declaration.type = DeclarationType::function;
+    } else if (is_extern && variable_name) {
+      name = variable_name;
+      declaration.type = DeclarationType::variable;
+    } else {
+      return;
+    }
+
+    for (const ScannedGuard& guard : guards) {
+      if (guard.skip) {
+        return;
+      }
+      declaration.introduced_32 = std::max(declaration.introduced_32, guard.introduced);
+      declaration.introduced_64 = std::max(declaration.introduced_64, guard.introduced);
+    }
+
+    declaration.name = name->text.str();
+    declaration.filename = filename;
+    declaration.line_number = lineNumber(name->offset);
+    output.push_back(declaration);
+  }
+
+ public:
+  HeaderScanner(std::string filename, StringRef buffer, std::vector<ScannedDeclaration>& output)
+      : filename(std::move(filename)), tokens(lexBuffer(buffer)), output(output) {
+    line_starts.push_back(0);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+      if (buffer[i] == '\n') {
+        line_starts.push_back(i + 1);
+      }
+    }
+  }
+
+  void scan() {
+    std::vector<const ScannedToken*> statement;
+
+    // Whether each enclosing brace belongs to an extern "C" block, which doesn't introduce scope.
+    std::vector<bool> braces;
+    size_t depth = 0;
+
+    for (size_t i = 0; i < tokens.size(); ++i) {
+      const ScannedToken& token = tokens[i];
+      if (token.kind == tok::hash && token.at_start_of_line) {
+        size_t end = i + 1;
+        while (end < tokens.size() && !tokens[end].at_start_of_line) {
+          ++end;
+        }
+        handleDirective(i + 1, end);
+        i = end - 1;
+        continue;
+      }
+
+      if (token.kind == tok::l_brace) {
+        if (depth == 0 && statement.size() == 2 && statement[0]->text == "extern" &&
+            statement[1]->kind == tok::string_literal) {
+          braces.push_back(true);
+          statement.clear();
+          continue;
+        }
+
+        // Function definitions don't need to be backed by a symbol.
+        if (depth == 0 && !statement.empty() && statement.back()->kind == tok::r_paren) {
+          statement.clear();
+        }
+
+        braces.push_back(false);
+        ++depth;
+        continue;
+      } else if (token.kind == tok::r_brace) {
+        if (!braces.empty()) {
+          if (!braces.back()) {
+            --depth;
+          }
+          braces.pop_back();
+        }
+        continue;
+      }
+
+      if (depth != 0) {
+        continue;
+      }
+
+      if (token.kind == tok::semi) {
+        handleStatement(statement);
+        statement.clear();
+      } else {
+        statement.push_back(&token);
+      }
+    }
+  }
+};
+
+static bool is64Bit(const std::string& arch) {
+  const ArchInfo* info = findArch(arch);
+  return info && info->lp64;
+}
+
+static std::string describeTypes(const std::vector<CompilationType>& types) {
+  std::vector<std::string> result;
+  for (const CompilationType& type : types) {
+    result.push_back(type.describe());
+  }
+  return Join(result, ", ");
+}
+
+static Diagnostic makeDiagnostic(DiagnosticCode code, const ScannedDeclaration& declaration,
+                                 const std::string& message,
+                                 std::vector<CompilationType> types = {}) {
+  Diagnostic result;
+  result.code = code;
+  result.symbol = declaration.name;
+  result.message = message + " (at " + declaration.filename + ":" +
+                   std::to_string(declaration.line_number) + ")";
+  result.filename = declaration.filename;
+  result.line_number = declaration.line_number;
+  result.types = std::move(types);
+  return result;
+}
+
+bool prescanHeaders(const std::set<CompilationType>& types, const std::string& header_dir,
+                    const NdkSymbolDatabase& symbol_database, DiagnosticSink& sink) {
+  PhaseTimer phase_timer("prescan");
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::string> headers = collectFiles(header_dir);
+  std::vector<ScannedDeclaration> declarations;
+  for (const std::string& header : headers) {
+    auto buffer = llvm::MemoryBuffer::getFile(header);
+    if (std::error_code ec = buffer.getError()) {
+      errx(1, "failed to read header '%s': %s", header.c_str(), ec.message().c_str());
+    }
+
+    HeaderScanner scanner(header, buffer.get()->getBuffer(), declarations);
+    scanner.scan();
+  }
+
+  bool failed = false;
+  for (const ScannedDeclaration& declaration : declarations) {
+    auto symbol_it = symbol_database.find(declaration.name);
+    if (symbol_it == symbol_database.end()) {
+      if (verbose) {
+        Diagnostic diagnostic = makeDiagnostic(DiagnosticCode::not_in_any_platform, declaration,
+                                               "not available in any platform");
+        diagnostic.severity = DiagnosticSeverity::note;
+        sink.report(std::move(diagnostic));
+      }
+      continue;
+    }
+
+    const std::map<CompilationType, NdkSymbolType>& symbol_availability = symbol_it->second;
+    std::set<std::string> present_archs;
+    for (const auto& it : symbol_availability) {
+      present_archs.insert(it.first.arch);
+    }
+
+    std::vector<CompilationType> missing;
+    std::vector<CompilationType> undeclared;
+    std::vector<CompilationType> mismatched;
+    for (const CompilationType& type : types) {
+      int introduced = is64Bit(type.arch) ? declaration.introduced_64 : declaration.introduced_32;
+      bool declared = !declaration.future && type.api_level >= introduced &&
+                      (declaration.obsoleted == 0 || type.api_level < declaration.obsoleted);
+
+      auto it = symbol_availability.find(type);
+      if (it == symbol_availability.end()) {
+        // Symbols that don't exist at all on an architecture are probably declared behind an
+        // architecture check that we can't see.
+        if (declared && (verbose || present_archs.count(type.arch) != 0)) {
+          missing.push_back(type);
+        }
+        continue;
+      }
+
+      if (!declared) {
+        undeclared.push_back(type);
+        continue;
+      }
+
+      bool is_function = it->second == NdkSymbolType::function;
+      if (is_function != (declaration.type == DeclarationType::function)) {
+        mismatched.push_back(type);
+      }
+    }
+
+    if (!missing.empty()) {
+      sink.report(makeDiagnostic(DiagnosticCode::missing_symbol, declaration,
+                                 "declared available, but missing in [" + describeTypes(missing) +
+                                   "]",
+                                 std::move(missing)));
+      failed = true;
+    }
+
+    if (!undeclared.empty()) {
+      sink.report(makeDiagnostic(DiagnosticCode::undeclared_availability, declaration,
+                                 "available in [" + describeTypes(undeclared) +
+                                   "], but not declared available",
+                                 std::move(undeclared)));
+      failed = true;
+    }
+
+    if (!mismatched.empty()) {
+      sink.report(makeDiagnostic(DiagnosticCode::symbol_type_mismatch, declaration,
+                                 "symbol type doesn't match its declaration as a "s +
+                                   declarationTypeName(declaration.type),
+                                 std::move(mismatched)));
+      failed = true;
+    }
+  }
+
+  if (verbose) {
+    auto duration = std::chrono::steady_clock::now() - start;
+    fprintf(stderr, "prescanned %zu declarations in %zu headers in %lld ms\n", declarations.size(),
+           headers.size(),
+           static_cast<long long>(
+             std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()));
+  }
+
+  return !failed;
+}
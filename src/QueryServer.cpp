@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "QueryServer.h"
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "DeclarationDatabase.h"
+#include "SymbolDatabase.h"
+#include "versioner.h"
+
+// Clients with an incomplete request longer than this are disconnected.
+static constexpr size_t max_request_length = 4096;
+
+// How much to read from a client at once. Nothing more is read from a client until the answers to
+// what it has already sent have been written, so this also bounds the memory used per client.
+static constexpr size_t read_size = 64 * 1024;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void handleInterrupt(int) {
+  interrupted = 1;
+}
+
+namespace {
+
+struct Client {
+  std::string input;
+  std::string output;
+  size_t output_offset = 0;
+  bool reading = true;
+  bool closing = false;
+};
+
+class QueryServer {
+  const std::set<CompilationType>& types;
+  const DeclarationDatabase& declarations;
+  const NdkSymbolDatabase* platform;
+
+  int epoll_fd = -1;
+  int listen_fd = -1;
+  std::unordered_map<int, Client> clients;
+
+  void answer(llvm::StringRef request, std::string* response) const;
+  void accept();
+  void handle(int fd, uint32_t events);
+  bool flush(int fd, Client& client);
+  void disconnect(int fd);
+
+ public:
+  explicit QueryServer(VersionerSession& session)
+      : types(session.compilationTypes()),
+        declarations(session.declarations()),
+        platform(session.getOptions().platform_dir.empty() ? nullptr
+                                                          : &session.platformSymbols()) {
+  }
+
+  ~QueryServer();
+
+  bool listen(const std::string& socket_path);
+  void run();
+};
+
+}  // namespace
+
+void QueryServer::answer(llvm::StringRef request, std::string* response) const {
+  llvm::SmallVector<llvm::StringRef, 3> fields;
+  request.rtrim().split(fields, ' ', -1, false);
+  if (fields.size() != 3) {
+    response->append("error expected SYMBOL ARCH API_LEVEL\n");
+    return;
+  }
+
+  int api_level;
+  if (fields[2].getAsInteger(10, api_level)) {
+    response->append("error invalid API level\n");
+    return;
+  }
+
+  CompilationType type = { .arch = fields[1].str(), .api_level = api_level };
+  if (types.count(type) == 0) {
+    response->append("error " + type.describe() + " wasn't compiled\n");
+    return;
+  }
+
+  std::string symbol = fields[0].str();
+  response->append(symbol + " " + type.describe() + " ");
+
+  const Declaration* declaration = declarations.find(symbol, type);
+  if (!declaration) {
+    response->append("undeclared ");
+  } else {
+    const DeclarationAvailability& availability = declaration->locations.begin()->availability;
+    bool available = (availability.introduced == 0 || api_level >= availability.introduced) &&
+                     (availability.obsoleted == 0 || api_level < availability.obsoleted);
+    response->append(available ? "available " : "unavailable ");
+    response->append(std::to_string(availability.introduced) + " " +
+                     std::to_string(availability.deprecated) + " " +
+                     std::to_string(availability.obsoleted) + " ");
+  }
+
+  if (!platform) {
+    response->append("-\n");
+  } else {
+    auto it = platform->find(symbol);
+    bool present = it != platform->end() && it->second.count(type) != 0;
+    response->append(present ? "1\n" : "0\n");
+  }
+}
+
+QueryServer::~QueryServer() {
+  for (const auto& it : clients) {
+    close(it.first);
+  }
+  if (listen_fd != -1) {
+    close(listen_fd);
+  }
+  if (epoll_fd != -1) {
+    close(epoll_fd);
+  }
+}
+
+bool QueryServer::listen(const std::string& socket_path) {
+  sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path)) {
+    warnx("socket path '%s' is too long", socket_path.c_str());
+    return false;
+  }
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  // Replace a socket left behind by a previous server, but nothing else.
+  struct stat st;
+  if (lstat(socket_path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    unlink(socket_path.c_str());
+  }
+
+  listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd == -1) {
+    warn("failed to create socket");
+    return false;
+  }
+
+  if (bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    warn("failed to bind to '%s'", socket_path.c_str());
+    return false;
+  }
+
+  if (::listen(listen_fd, SOMAXCONN) != 0) {
+    warn("failed to listen on '%s'", socket_path.c_str());
+    return false;
+  }
+
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    warn("failed to create epoll instance");
+    return false;
+  }
+
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = listen_fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+    warn("failed to watch the listening socket");
+    return false;
+  }
+
+  return true;
+}
+
+void QueryServer::accept() {
+  while (true) {
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        warn("failed to accept a client");
+      }
+      return;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      warn("failed to watch a client");
+      close(fd);
+      continue;
+    }
+    clients[fd];
+  }
+}
+
+void QueryServer::disconnect(int fd) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  clients.erase(fd);
+}
+
+// Write as much of a client's pending output as it will take. Returns false on error.
+bool QueryServer::flush(int fd, Client& client) {
+  while (client.output_offset < client.output.size()) {
+    ssize_t rc = send(fd, client.output.data() + client.output_offset,
+                      client.output.size() - client.output_offset, MSG_NOSIGNAL);
+    if (rc >= 0) {
+      client.output_offset += rc;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    } else if (errno != EINTR) {
+      return false;
+    }
+  }
+
+  client.output.clear();
+  client.output_offset = 0;
+  return true;
+}
+
+void QueryServer::handle(int fd, uint32_t events) {
+  Client& client = clients[fd];
+
+  if (client.reading && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+    char buffer[read_size];
+    ssize_t rc = read(fd, buffer, sizeof(buffer));
+    if (rc > 0) {
+      client.input.append(buffer, rc);
+    } else if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      // Answer whatever complete requests the client sent before hanging up.
+      client.closing = true;
+    }
+
+    size_t start = 0;
+    size_t newline;
+    while ((newline = client.input.find('\n', start)) != std::string::npos) {
+      answer(llvm::StringRef(client.input).slice(start, newline), &client.output);
+      start = newline + 1;
+    }
+    client.input.erase(0, start);
+
+    if (client.input.size() > max_request_length) {
+      client.output.append("error request too long\n");
+      client.closing = true;
+    }
+  }
+
+  if (!flush(fd, client)) {
+    disconnect(fd);
+    return;
+  }
+
+  bool pending = !client.output.empty();
+  if (client.closing && !pending) {
+    disconnect(fd);
+    return;
+  }
+
+  // Stop reading from a client until it has taken the answers to its previous requests.
+  bool reading = !pending && !client.closing;
+  if (reading != client.reading) {
+    epoll_event event = {};
+    event.events = reading ? EPOLLIN : EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+    client.reading = reading;
+  }
+}
+
+void QueryServer::run() {
+  epoll_event events[64];
+  while (!interrupted) {
+    int count = epoll_wait(epoll_fd, events, 64, -1);
+    if (count == -1) {
+      if (errno != EINTR) {
+        warn("epoll_wait failed");
+        return;
+      }
+      continue;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.fd == listen_fd) {
+        accept();
+      } else if (clients.count(events[i].data.fd) != 0) {
+        handle(events[i].data.fd, events[i].events);
+      }
+    }
+  }
+}
+
+bool serveQueries(VersionerSession& session, const std::string& socket_path) {
+  QueryServer server(session);
+  if (!server.listen(socket_path)) {
+    return false;
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = handleInterrupt;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  if (verbose) {
+    fprintf(stderr, "serving queries on '%s'\n", socket_path.c_str());
+  }
+
+  server.run();
+  unlink(socket_path.c_str());
+  return true;
+}
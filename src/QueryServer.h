@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "Session.h"
+
+// Answer availability queries over a Unix domain socket at socket_path, until the process is
+// interrupted. The session's declarations and platform symbols are computed once up front, and
+// every client is served from them by a single event loop.
+//
+// The protocol is line based, so that a batch of queries is just several lines written at once.
+// Each request line is
+//
+//   SYMBOL ARCH API_LEVEL
+//
+// and is answered, in order, by one line of
+//
+//   SYMBOL ARCH-API_LEVEL STATUS [INTRODUCED DEPRECATED OBSOLETED] PLATFORM
+//
+// where STATUS is "available" or "unavailable" (declared, and the API level is or isn't within the
+// declared availability, whose bounds follow, with 0 meaning unbounded) or "undeclared". PLATFORM
+// is "1" or "0" for whether the NDK platform has the symbol, or "-" if there's no platform to
+// compare against. A request that can't be answered (because it's malformed, or its type wasn't
+// compiled) gets "error MESSAGE" instead.
+//
+// Returns false if the socket couldn't be set up.
+bool serveQueries(VersionerSession& session, const std::string& socket_path);
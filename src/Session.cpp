@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "Session.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Checks.h"
+#include "CostDatabase.h"
+#include "Driver.h"
+#include "FileCache.h"
+#include "versioner.h"
+
+VersionerSession::VersionerSession(VersionerOptions opts) : options(std::move(opts)) {
+  types = generateCompilationTypes(options.archs, options.levels);
+}
+
+std::unique_ptr<VersionerSession> VersionerSession::create(VersionerOptions options,
+                                                           std::string* error) {
+  if (options.archs.empty()) {
+    options.archs = supportedArchs();
+  }
+
+  if (options.levels.empty()) {
+    options.levels = supportedLevels();
+  }
+
+  for (const std::string& arch : options.archs) {
+    if (!findArch(arch)) {
+      *error = "unsupported architecture: " + arch;
+      return nullptr;
+    }
+  }
+
+  for (int api_level : options.levels) {
+    if (!isSupportedLevel(api_level)) {
+      *error = "unsupported API level " + std::to_string(api_level);
+      return nullptr;
+    }
+  }
+
+  return std::unique_ptr<VersionerSession>(new VersionerSession(std::move(options)));
+}
+
+void VersionerSession::resetSanityCheck() {
+  sanity_passed = true;
+  sanity_diagnostics.clear();
+}
+
+void VersionerSession::checkArchitecture(const std::set<CompilationType>& arch_types,
+                                         const DeclarationDatabase& database) {
+  // Hold on to what's found until sanityCheck is called.
+  DiagnosticCollector collector(sanity_diagnostics[arch_types.begin()->arch]);
+  if (!::sanityCheck(arch_types, database, collector)) {
+    sanity_passed = false;
+  }
+}
+
+const DeclarationDatabase& VersionerSession::declarations() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!headers_compiled) {
+    // Parsing the platform is mostly I/O, so do it while the headers compile.
+    std::thread platform_thread([this]() { platformSymbols(); });
+
+    ParseCostDatabase parse_costs;
+    if (!options.cost_path.empty()) {
+      parse_costs.load(options.cost_path);
+    }
+
+    resetSanityCheck();
+    auto on_arch_compiled = [this](size_t, const std::set<CompilationType>& arch_types,
+                                   const DeclarationDatabase& database) {
+      checkArchitecture(arch_types, database);
+    };
+    declaration_database =
+      compileHeaders(types, options.header_dir, options.dependency_dir, parse_costs,
+                     options.memory_budget, options.cxx ? &cxx_declaration_database : nullptr,
+                     on_arch_compiled);
+
+    if (!options.cost_path.empty()) {
+      parse_costs.save(options.cost_path);
+    }
+    headers_compiled = true;
+    platform_thread.join();
+  }
+  return declaration_database;
+}
+
+const DeclarationDatabase& VersionerSession::cxxDeclarations() {
+  declarations();
+  return cxx_declaration_database;
+}
+
+const NdkSymbolDatabase& VersionerSession::platformSymbols() {
+  std::lock_guard<std::mutex> lock(platform_mutex);
+  if (!platform_parsed) {
+    NdkSymbolDatabase result;
+    if (!options.platform_dir.empty()) {
+      result = parsePlatforms(types, options.platform_dir);
+    }
+    symbol_database = std::make_shared<const NdkSymbolDatabase>(std::move(result));
+    platform_parsed = true;
+  }
+  return *symbol_database;
+}
+
+bool VersionerSession::getAvailability(const std::string& symbol, const CompilationType& type,
+                                       DeclarationAvailability* availability) {
+  const Declaration* declaration = declarations().find(symbol, type);
+  if (!declaration) {
+    return false;
+  }
+
+  *availability = declaration->locations.begin()->availability;
+  return true;
+}
+
+bool VersionerSession::sanityCheck(DiagnosticSink& sink) {
+  const DeclarationDatabase& database = declarations();
+
+  // Each architecture was checked as it finished compiling, so all that's left is to compare them
+  // with each other, and then to report everything in symbol order, as a single pass would have.
+  std::vector<Diagnostic> diagnostics;
+  for (const auto& it : sanity_diagnostics) {
+    diagnostics.insert(diagnostics.end(), it.second.begin(), it.second.end());
+  }
+  DiagnosticCollector collector(diagnostics);
+  checkPrototypesAcrossArchs(types, database, collector);
+  std::stable_sort(diagnostics.begin(), diagnostics.end(),
+                   [](const Diagnostic& lhs, const Diagnostic& rhs) {
+                     return lhs.symbol < rhs.symbol;
+                   });
+
+  for (Diagnostic& diagnostic : diagnostics) {
+    sink.report(std::move(diagnostic));
+  }
+  return sanity_passed;
+}
+
+bool VersionerSession::sanityCheck(std::vector<Diagnostic>* diagnostics) {
+  DiagnosticCollector collector(*diagnostics);
+  return sanityCheck(collector);
+}
+
+bool VersionerSession::checkVersions(DiagnosticSink& sink) {
+  if (options.platform_dir.empty()) {
+    return true;
+  }
+  return ::checkVersions(types, declarations(), platformSymbols(), sink);
+}
+
+bool VersionerSession::checkVersions(std::vector<Diagnostic>* diagnostics) {
+  DiagnosticCollector collector(*diagnostics);
+  return checkVersions(collector);
+}
+
+bool VersionerSession::checkLanguages(DiagnosticSink& sink) {
+  if (!options.cxx) {
+    return true;
+  }
+  return ::checkLanguages(declarations(), cxxDeclarations(), sink);
+}
+
+bool VersionerSession::checkLanguages(std::vector<Diagnostic>* diagnostics) {
+  DiagnosticCollector collector(*diagnostics);
+  return checkLanguages(collector);
+}
+
+void VersionerSession::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::lock_guard<std::mutex> platform_lock(platform_mutex);
+  headers_compiled = false;
+  declaration_database.clear();
+  cxx_declaration_database.clear();
+  resetSanityCheck();
+  platform_parsed = false;
+  symbol_database.reset();
+
+  // The prefetched files are stale too.
+  file_cache.clear();
+}
+
+bool prepareSessions(const std::vector<VersionerSession*>& sessions, std::string* error) {
+  if (sessions.empty()) {
+    return true;
+  }
+
+  VersionerSession* first = sessions[0];
+  const VersionerOptions& options = first->options;
+  for (VersionerSession* session : sessions) {
+    if (session->options.platform_dir != options.platform_dir ||
+        session->options.cost_path != options.cost_path ||
+        session->options.memory_budget != options.memory_budget ||
+        session->options.cxx != options.cxx || session->types != first->types) {
+      *error = "sessions prepared together must share their options";
+      return false;
+    }
+  }
+
+  // As in declarations(), parse the platform while the headers compile.
+  std::thread platform_thread([first]() { first->platformSymbols(); });
+
+  std::vector<HeaderTree> trees;
+  for (VersionerSession* session : sessions) {
+    trees.push_back({ .header_dir = session->options.header_dir,
+                      .dependency_dir = session->options.dependency_dir });
+  }
+
+  ParseCostDatabase parse_costs;
+  if (!options.cost_path.empty()) {
+    parse_costs.load(options.cost_path);
+  }
+
+  for (VersionerSession* session : sessions) {
+    session->resetSanityCheck();
+  }
+  auto on_arch_compiled = [&sessions](size_t tree, const std::set<CompilationType>& arch_types,
+                                      const DeclarationDatabase& database) {
+    sessions[tree]->checkArchitecture(arch_types, database);
+  };
+
+  std::vector<DeclarationDatabase> cxx_databases;
+  std::vector<DeclarationDatabase> databases =
+    compileHeaderTrees(first->types, trees, parse_costs, options.memory_budget,
+                       options.cxx ? &cxx_databases : nullptr, on_arch_compiled);
+  platform_thread.join();
+
+  if (!options.cost_path.empty()) {
+    parse_costs.save(options.cost_path);
+  }
+
+  for (size_t i = 0; i < sessions.size(); ++i) {
+    VersionerSession* session = sessions[i];
+    std::lock_guard<std::mutex> lock(session->mutex);
+    session->declaration_database = std::move(databases[i]);
+    if (options.cxx) {
+      session->cxx_declaration_database = std::move(cxx_databases[i]);
+    }
+    session->headers_compiled = true;
+    if (session != first) {
+      std::lock_guard<std::mutex> platform_lock(session->platform_mutex);
+      session->symbol_database = first->symbol_database;
+      session->platform_parsed = true;
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *  * Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in
+ *    the documentation and/or other materials provided with the
+ *    distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "DeclarationDatabase.h"
+#include "Diagnostics.h"
+#include "SymbolDatabase.h"
+
+struct VersionerOptions {
+  std::string header_dir;
+  std::string dependency_dir;
+
+  // The NDK platform to compare against, if any.
+  std::string platform_dir;
+
+  // The architectures and API levels to compile for. Empty means everything supported.
+  std::set<std::string> archs;
+  std::set<int> levels;
+
+  // Where to load and save per-header parse costs, if anywhere.
+  std::string cost_path;
+
+  // The most memory that compiling the headers may use, in bytes, or 0 for the default.
+  uint64_t memory_budget = 0;
+
+  // Also compile the headers as C++, so that they can be checked from both languages.
+  bool cxx = false;
+};
+
+// The in-process interface to versioner, for tools that want to query it repeatedly without
+// spawning a process and reparsing the headers each time. Results are computed on first use and
+// cached until invalidate() is called. Queries may be made from multiple threads concurrently,
+// but invalidate() must not race with them.
+class VersionerSession {
+  VersionerOptions options;
+  std::set<CompilationType> types;
+
+  std::mutex mutex;
+  bool headers_compiled = false;
+  DeclarationDatabase declaration_database;
+  DeclarationDatabase cxx_declaration_database;
+
+  // What sanityCheck found in each architecture, checked as soon as it finished compiling. Kept by
+  // architecture, since they finish in no particular order.
+  bool sanity_passed = true;
+  std::map<std::string, std::vector<Diagnostic>> sanity_diagnostics;
+
+  // The platform has a lock of its own, so that it can be parsed while the headers compile.
+  std::mutex platform_mutex;
+  bool platform_parsed = false;
+  std::shared_ptr<const NdkSymbolDatabase> symbol_database;
+
+  friend bool prepareSessions(const std::vector<VersionerSession*>& sessions, std::string* error);
+
+  explicit VersionerSession(VersionerOptions options);
+
+  void resetSanityCheck();
+  void checkArchitecture(const std::set<CompilationType>& arch_types,
+                         const DeclarationDatabase& database);
+
+ public:
+  // Create a session, filling in the default architectures and API levels. Returns null, with a
+  // description in error, if the options ask for something that isn't supported.
+  static std::unique_ptr<VersionerSession> create(VersionerOptions options, std::string* error);
+
+  const VersionerOptions& getOptions() const {
+    return options;
+  }
+
+  const std::set<CompilationType>& compilationTypes() const {
+    return types;
+  }
+
+  // Map from symbol name to its declaration in each CompilationType.
+  const DeclarationDatabase& declarations();
+
+  // The same, for the headers compiled as C++ (under the C++ versions of the CompilationTypes).
+  // Empty unless the cxx option is set.
+  const DeclarationDatabase& cxxDeclarations();
+
+  // Map from symbol name to its presence in the NDK platform for each CompilationType.
+  // Empty if there's no platform_dir.
+  const NdkSymbolDatabase& platformSymbols();
+
+  // Look up the declared availability of a symbol for a CompilationType.
+  // Returns false if the symbol isn't declared for that type.
+  bool getAvailability(const std::string& symbol, const CompilationType& type,
+                       DeclarationAvailability* availability);
+
+  // Run the consistency checks, reporting what they find to sink, or appending it to diagnostics.
+  // These return false if any errors were found.
+  bool sanityCheck(DiagnosticSink& sink);
+  bool sanityCheck(std::vector<Diagnostic>* diagnostics);
+  bool checkVersions(DiagnosticSink& sink);
+  bool checkVersions(std::vector<Diagnostic>* diagnostics);
+  bool checkLanguages(DiagnosticSink& sink);
+  bool checkLanguages(std::vector<Diagnostic>* diagnostics);
+
+  // Forget everything that's been computed, e.g. because the headers have changed.
+  void invalidate();
+};
+
+// Compile the headers of several sessions at once, scheduling all of their compilations on a
+// single worker pool, and parse the NDK platform only once for all of them. The sessions must have
+// the same options, other than their header and dependency directories. Returns false, with a
+// description in error, if they don't.
+bool prepareSessions(const std::vector<VersionerSession*>& sessions, std::string* error);
@@ -28,88 +28,137 @@
 
 #include "SymbolDatabase.h"
 
+#include <elf.h>
 #include <err.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <memory>
 #include <string>
+#include <tuple>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
-#include "llvm/Object/Binary.h"
-#include "llvm/Object/ELFObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
 
+#include "ElfReader.h"
+#include "FileCache.h"
+#include "Metrics.h"
+#include "Utils.h"
 #include "versioner.h"
 
-using namespace llvm;
-using namespace llvm::object;
-
 std::unordered_set<std::string> getSymbols(const std::string& filename) {
   std::unordered_set<std::string> result;
-  auto binary = createBinary(filename);
-  if (std::error_code ec = binary.getError()) {
-    errx(1, "failed to open library at %s: %s\n", filename.c_str(), ec.message().c_str());
-    abort();
-  }
+  std::unique_ptr<ElfLibrary> library = ElfLibrary::open(filename);
+  result.reserve(library->symbolCount());
+  library->forEachSymbol([&result](const ElfSymbol& symbol) {
+    // Skip the symbols that the library imports from elsewhere, and those that only exist for the
+    // platform's own use.
+    if (symbol.defined && !isPrivateVersion(symbol.version)) {
+      result.emplace(symbol.name.data(), symbol.name.size());
+    }
+  });
+  return result;
+}
 
-  ELFObjectFileBase* elf = dyn_cast_or_null<ELFObjectFileBase>(binary.get().getBinary());
-  if (!elf) {
-    errx(1, "failed to parse %s as ELF", filename.c_str());
-  }
+LibrarySymbolTable getSymbolTable(const std::string& filename) {
+  LibrarySymbolTable result;
+  std::unique_ptr<ElfLibrary> library = ElfLibrary::open(filename);
+  result.reserve(library->symbolCount());
+  library->forEachSymbol([&result](const ElfSymbol& symbol) {
+    if (!symbol.defined) {
+      return;
+    }
+
+    NdkSymbolType type;
+    switch (symbol.type) {
+      case STT_FUNC:
+      case STT_GNU_IFUNC:
+        type = NdkSymbolType::function;
+        break;
 
-  for (const ELFSymbolRef symbol : elf->getDynamicSymbolIterators()) {
-    ErrorOr<StringRef> symbol_name = symbol.getName();
+      case STT_OBJECT:
+      case STT_COMMON:
+      case STT_TLS:
+        type = NdkSymbolType::variable;
+        break;
 
-    if (std::error_code ec = binary.getError()) {
-      errx(1, "failed to get symbol name for symbol in %s: %s", filename.c_str(),
-           ec.message().c_str());
+      default:
+        return;
     }
 
-    result.insert(symbol_name.get().str());
-  }
+    // If there are multiple versions of a symbol, describe the default one. The name is copied
+    // straight into the table, rather than through a temporary string.
+    auto inserted = result.emplace(std::piecewise_construct,
+                                   std::forward_as_tuple(symbol.name.data(), symbol.name.size()),
+                                   std::forward_as_tuple());
+    if (symbol.hidden && !inserted.second) {
+      return;
+    }
 
+    LibrarySymbol& entry = inserted.first->second;
+    entry.type = type;
+    entry.size = symbol.size;
+    entry.version_level = versionApiLevel(symbol.version);
+    entry.is_private = isPrivateVersion(symbol.version);
+  });
   return result;
 }
 
 // The NDK platforms are built by copying the platform directories on top of
 // each other to build each successive API version. Thus, we need to walk
 // backwards to find each desired file.
-static FILE* findFile(const CompilationType& type, const std::string& platform_dir,
-                      const std::string& filename) {
+static std::string platformFilePath(const std::string& platform_dir, const std::string& arch,
+                                    int api_level, const std::string& filename) {
+  return platform_dir + "/android-" + std::to_string(api_level) + "/arch-" + arch + "/symbols/" +
+         filename;
+}
+
+static std::unique_ptr<llvm::MemoryBuffer> findFile(const CompilationType& type,
+                                                    const std::string& platform_dir,
+                                                    const std::string& filename) {
   int api_level = type.api_level;
+  int min_api = archMinApi(type.arch);
   while (true) {
-    if (api_level < arch_min_api[type.arch]) {
+    if (api_level < min_api) {
       return nullptr;
     }
 
-    if (supported_levels.count(api_level) == 0) {
+    if (!isSupportedLevel(api_level)) {
       --api_level;
       continue;
     }
 
-    std::string path = std::string(platform_dir) + "/android-" + std::to_string(api_level) +
-                       "/arch-" + type.arch + "/symbols/" + filename;
+    std::string path = platformFilePath(platform_dir, type.arch, api_level, filename);
 
-    FILE* file = fopen(path.c_str(), "r");
+    llvm::StringRef contents;
+    if (file_cache.find(path, &contents)) {
+      return llvm::MemoryBuffer::getMemBuffer(contents, path);
+    }
 
-    if (file) {
-      return file;
+    if (!file_cache.isMissing(path)) {
+      auto buffer = llvm::MemoryBuffer::getFile(path);
+      if (buffer) {
+        return std::move(buffer.get());
+      }
     }
 
     --api_level;
   }
 }
 
+static const std::set<std::string> wanted_files = {
+  "libc.so.functions.txt",
+  "libc.so.variables.txt",
+  "libdl.so.functions.txt",
+  "libm.so.functions.txt",
+  "libm.so.variables.txt",
+};
+
 static std::map<std::string, NdkSymbolType> parsePlatform(const CompilationType& type,
                                                           const std::string& platform_dir) {
   std::map<std::string, NdkSymbolType> result;
-  std::set<std::string> wanted_files = {
-    "libc.so.functions.txt",
-    "libc.so.variables.txt",
-    "libdl.so.functions.txt",
-    "libm.so.functions.txt",
-    "libm.so.variables.txt",
-  };
-
   for (const std::string& file : wanted_files) {
     NdkSymbolType symbol_type;
     if (EndsWith(file, ".functions.txt")) {
@@ -118,23 +167,17 @@ static std::map<std::string, NdkSymbolType> parsePlatform(const CompilationType&
       symbol_type = NdkSymbolType::variable;
     }
 
-    FILE* f = findFile(type, platform_dir, file);
-    if (!f) {
+    std::unique_ptr<llvm::MemoryBuffer> buffer = findFile(type, platform_dir, file);
+    if (!buffer) {
       err(1, "failed to find %s platform file '%s'", type.describe().c_str(), file.c_str());
     }
 
-    while (true) {
-      char* line = nullptr;
-      size_t len = 0;
-      ssize_t rc = getline(&line, &len, f);
-
-      if (rc < 0) {
-        break;
-      }
-
-      std::string symbol_name = Trim(line);
-      free(line);
+    llvm::StringRef remaining = buffer->getBuffer();
+    while (!remaining.empty()) {
+      llvm::StringRef line;
+      std::tie(line, remaining) = remaining.split('\n');
 
+      std::string symbol_name = line.trim().str();
       if (symbol_name.empty()) {
         continue;
       }
@@ -147,8 +190,6 @@ static std::map<std::string, NdkSymbolType> parsePlatform(const CompilationType&
 
       result[symbol_name] = symbol_type;
     }
-
-    fclose(f);
   }
 
   return result;
@@ -156,6 +197,23 @@ static std::map<std::string, NdkSymbolType> parsePlatform(const CompilationType&
 
 NdkSymbolDatabase parsePlatforms(const std::set<CompilationType>& types,
                                  const std::string& platform_dir) {
+  PhaseTimer phase_timer("platform");
+
+  // Prefetch every file that findFile might probe for.
+  std::vector<std::string> manifest;
+  for (const CompilationType& type : types) {
+    int min_api = archMinApi(type.arch);
+    for (int api_level : supported_level_list) {
+      if (api_level < min_api || api_level > type.api_level) {
+        continue;
+      }
+      for (const std::string& file : wanted_files) {
+        manifest.push_back(platformFilePath(platform_dir, type.arch, api_level, file));
+      }
+    }
+  }
+  file_cache.prefetch(manifest);
+
   std::map<std::string, std::map<CompilationType, NdkSymbolType>> result;
   for (const CompilationType& type : types) {
     std::map<std::string, NdkSymbolType> symbols = parsePlatform(type, platform_dir);
@@ -164,5 +222,6 @@ NdkSymbolDatabase parsePlatforms(const std::set<CompilationType>& types,
     }
   }
 
+  run_metrics.add(RunCounter::platform_symbols, result.size());
   return result;
 }
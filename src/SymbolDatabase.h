@@ -28,13 +28,17 @@
 
 #pragma once
 
+#include <stdint.h>
+
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "DeclarationDatabase.h"
 
+// Get the names of the public symbols exported by a library.
 using LibrarySymbolDatabase = std::unordered_set<std::string>;
 std::unordered_set<std::string> getSymbols(const std::string& filename);
 
@@ -43,6 +47,30 @@ enum class NdkSymbolType {
   variable,
 };
 
+static __attribute__((unused)) const char* ndkSymbolTypeName(NdkSymbolType type) {
+  switch (type) {
+    case NdkSymbolType::function:
+      return "function";
+    case NdkSymbolType::variable:
+      return "variable";
+  }
+}
+
+struct LibrarySymbol {
+  NdkSymbolType type;
+  uint64_t size;
+
+  // The API level implied by the symbol's version (e.g. 24 for LIBC_N), or 0 if unknown.
+  int version_level;
+
+  // Whether the symbol's version is for the platform's internal use (e.g. LIBC_PRIVATE).
+  bool is_private;
+};
+
+// Get the defined function and variable symbols exported by a library.
+using LibrarySymbolTable = std::unordered_map<std::string, LibrarySymbol>;
+LibrarySymbolTable getSymbolTable(const std::string& filename);
+
 using NdkSymbolDatabase = std::map<std::string, std::map<CompilationType, NdkSymbolType>>;
 NdkSymbolDatabase parsePlatforms(const std::set<CompilationType>& types,
                                  const std::string& platform_dir);
@@ -29,8 +29,11 @@
 #include "Utils.h"
 
 #include <err.h>
+#include <errno.h>
 #include <fts.h>
+#include <stdio.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <string>
@@ -114,3 +117,48 @@ std::vector<std::string> collectFiles(const std::string& directory) {
   fts_close(fts);
   return files;
 }
+
+void makeDirectories(const std::string& path) {
+  for (size_t end = path.find('/', 1);; end = path.find('/', end + 1)) {
+    std::string prefix = path.substr(0, end);
+    if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) {
+      err(1, "failed to create directory '%s'", prefix.c_str());
+    }
+    if (end == std::string::npos) {
+      return;
+    }
+  }
+}
+
+std::string getRelativePath(const std::string& path, const std::string& directory) {
+  std::string result = path.substr(directory.length());
+  while (StartsWith(result, "/")) {
+    result = result.substr(1);
+  }
+  return result;
+}
+
+uint64_t getResidentMemory() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  if (!statm) {
+    return 0;
+  }
+
+  unsigned long long size;
+  unsigned long long resident;
+  int fields = fscanf(statm, "%llu %llu", &size, &resident);
+  fclose(statm);
+  if (fields != 2) {
+    return 0;
+  }
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+uint64_t getPhysicalMemory() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long page_size = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page_size <= 0) {
+    return 0;
+  }
+  return static_cast<uint64_t>(pages) * page_size;
+}
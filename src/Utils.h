@@ -28,7 +28,11 @@
 
 #pragma once
 
+#include <stdint.h>
+
+#include <atomic>
 #include <string>
+#include <thread>
 #include <vector>
 
 bool StartsWith(const std::string& string, const std::string& prefix);
@@ -36,6 +40,17 @@ bool EndsWith(const std::string& string, const std::string& suffix);
 std::string getWorkingDir();
 std::vector<std::string> collectFiles(const std::string& directory);
 
+// Get the resident set size of this process, and the physical memory of the machine, in bytes.
+// Both return 0 if they can't be determined.
+uint64_t getResidentMemory();
+uint64_t getPhysicalMemory();
+
+// Create a directory and any missing parents, exiting on failure.
+void makeDirectories(const std::string& path);
+
+// Get the path of a file in directory (e.g. one returned by collectFiles) relative to it.
+std::string getRelativePath(const std::string& path, const std::string& directory);
+
 namespace std {
 static __attribute__((unused)) std::string to_string(const char* c) {
   return c;
@@ -60,3 +75,28 @@ static std::string Join(Collection c, const std::string& delimiter = ", ") {
 }
 
 std::string Trim(const std::string& s);
+
+// Call fn(i) for each i in [0, count), distributing the calls across a pool of threads.
+template <typename Function>
+static void ParallelFor(size_t count, Function fn,
+                        size_t thread_count = std::thread::hardware_concurrency()) {
+  if (thread_count == 0) {
+    thread_count = 1;
+  }
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < thread_count && i < count; ++i) {
+    threads.emplace_back(worker);
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
@@ -26,460 +26,199 @@
  * SUCH DAMAGE.
  */
 
-#include <dirent.h>
 #include <err.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#include <iostream>
-#include <map>
 #include <memory>
 #include <set>
-#include <sstream>
 #include <string>
-#include <thread>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "clang/Tooling/Tooling.h"
-
+#include "Annotator.h"
+#include "Baseline.h"
+#include "CostDatabase.h"
 #include "DeclarationDatabase.h"
+#include "DeviceLibraries.h"
+#include "Diagnostics.h"
+#include "Driver.h"
+#include "Flattener.h"
+#include "Generator.h"
+#include "Metrics.h"
+#include "Prescan.h"
+#include "QueryServer.h"
+#include "Session.h"
 #include "SymbolDatabase.h"
 #include "Utils.h"
 #include "versioner.h"
 
-using namespace std::string_literals;
-using namespace clang::tooling;
-
-bool verbose;
-
-class HeaderCompilationDatabase : public CompilationDatabase {
-  CompilationType type;
-  std::string cwd;
-  std::vector<std::string> headers;
-  std::vector<std::string> include_dirs;
+// Tags diagnostics with the header tree that they're about, in batch mode.
+class TreeDiagnosticSink : public DiagnosticSink {
+  DiagnosticSink& sink;
+  std::string tree;
 
  public:
-  HeaderCompilationDatabase(CompilationType type, std::string cwd, std::vector<std::string> headers,
-                            std::vector<std::string> include_dirs)
-      : type(type),
-        cwd(std::move(cwd)),
-        headers(std::move(headers)),
-        include_dirs(std::move(include_dirs)) {
+  TreeDiagnosticSink(DiagnosticSink& sink, std::string tree) : sink(sink), tree(std::move(tree)) {
   }
 
-  CompileCommand generateCompileCommand(const std::string& filename) const {
-    std::vector<std::string> command = { "clang-tool", filename, "-nostdlibinc" };
-    for (const auto& dir : include_dirs) {
-      command.push_back("-isystem");
-      command.push_back(dir);
-    }
-    command.push_back("-std=c11");
-    command.push_back("-DANDROID");
-    command.push_back("-D__ANDROID_API__="s + std::to_string(type.api_level));
-    command.push_back("-D_FORTIFY_SOURCE=2");
-    command.push_back("-D_GNU_SOURCE");
-    command.push_back("-Wno-unknown-attributes");
-    command.push_back("-target");
-    command.push_back(arch_targets[type.arch]);
-
-    return CompileCommand(cwd, filename, command);
-  }
-
-  std::vector<CompileCommand> getAllCompileCommands() const override {
-    std::vector<CompileCommand> commands;
-    for (const std::string& file : headers) {
-      commands.push_back(generateCompileCommand(file));
-    }
-    return commands;
+  void report(Diagnostic diagnostic) override {
+    diagnostic.tree = tree;
+    sink.report(std::move(diagnostic));
   }
-
-  std::vector<CompileCommand> getCompileCommands(StringRef file) const override {
-    std::vector<CompileCommand> commands;
-    commands.push_back(generateCompileCommand(file));
-    return commands;
-  }
-
-  std::vector<std::string> getAllFiles() const override {
-    return headers;
-  }
-};
-
-struct CompilationRequirements {
-  std::vector<std::string> headers;
-  std::vector<std::string> dependencies;
 };
 
-static CompilationRequirements collectRequirements(const std::string& arch,
-                                                   const std::string& header_dir,
-                                                   const std::string& dependency_dir) {
-  std::vector<std::string> headers = collectFiles(header_dir);
-
-  std::vector<std::string> dependencies = { header_dir };
-  if (!dependency_dir.empty()) {
-    auto collect_children = [&dependencies](const std::string& dir_path) {
-      DIR* dir = opendir(dir_path.c_str());
-      if (!dir) {
-        err(1, "failed to open dependency dir");
-      }
-
-      struct dirent* dent;
-      while ((dent = readdir(dir))) {
-        if (dent->d_name[0] == '.') {
-          continue;
-        }
+// Writes the run's metrics to a file when it goes out of scope, so that every way out of main that
+// doesn't exit outright is covered.
+class MetricsExport {
+  std::string path;
 
-        // TODO: Resolve symlinks.
-        std::string dependency = dir_path + "/" + dent->d_name;
-        dependencies.push_back(dependency);
-      }
-
-      closedir(dir);
-    };
-
-    collect_children(dependency_dir + "/common");
-    collect_children(dependency_dir + "/" + arch);
+ public:
+  explicit MetricsExport(std::string path) : path(std::move(path)) {
   }
 
-  auto new_end = std::remove_if(headers.begin(), headers.end(), [&arch](const std::string& header) {
-    for (const auto& it : header_blacklist) {
-      if (it.second.find(arch) == it.second.end()) {
-        continue;
-      }
-
-      if (EndsWith(header, "/" + it.first)) {
-        return true;
-      }
-    }
-    return false;
-  });
-
-  headers.erase(new_end, headers.end());
-
-  CompilationRequirements result = { .headers = headers, .dependencies = dependencies };
-  return result;
-}
-
-static std::set<CompilationType> generateCompilationTypes(
-  const std::set<std::string> selected_architectures, const std::set<int>& selected_levels) {
-  std::set<CompilationType> result;
-  for (const std::string& arch : selected_architectures) {
-    int min_api = arch_min_api[arch];
-    for (int api_level : selected_levels) {
-      if (api_level < min_api) {
-        continue;
-      }
-      CompilationType type = { .arch = arch, .api_level = api_level };
-      result.insert(type);
+  ~MetricsExport() {
+    if (!path.empty()) {
+      run_metrics.write(path);
     }
   }
-  return result;
-}
 
-using DeclarationDatabase = std::map<std::string, std::map<CompilationType, Declaration>>;
+  MetricsExport(const MetricsExport&) = delete;
+  MetricsExport& operator=(const MetricsExport&) = delete;
+};
 
-static DeclarationDatabase transposeHeaderDatabases(
-  const std::map<CompilationType, HeaderDatabase>& original) {
-  DeclarationDatabase result;
-  for (const auto& outer : original) {
-    const CompilationType& type = outer.first;
-    for (const auto& inner : outer.second.declarations) {
-      const std::string& symbol_name = inner.first;
-      result[symbol_name][type] = inner.second;
-    }
+// Compare the availability of the declarations in a header tree against an older version of it,
+// only compiling the headers that differ between the two.
+static bool diffBaseline(const std::set<CompilationType>& types, const HeaderTree& tree,
+                         const std::string& baseline_dir, const std::string& cost_path,
+                         uint64_t memory_budget, DiagnosticSink& sink) {
+  std::set<std::string> changed = findChangedHeaders(baseline_dir, tree.header_dir);
+  if (verbose) {
+    fprintf(stderr, "%zu headers differ from the baseline\n", changed.size());
   }
-  return result;
-}
-
-static DeclarationDatabase compileHeaders(const std::set<CompilationType>& types,
-                                          const std::string& header_dir,
-                                          const std::string& dependency_dir) {
-  constexpr size_t thread_count = 8;
-  size_t threads_created = 0;
-  std::mutex mutex;
-  std::vector<std::thread> threads(thread_count);
-
-  std::map<CompilationType, HeaderDatabase> header_databases;
-  std::unordered_map<std::string, CompilationRequirements> requirements;
 
-  std::string cwd = getWorkingDir();
-
-  for (const auto& arch : supported_archs) {
-    requirements[arch] = collectRequirements(arch, header_dir, dependency_dir);
+  if (changed.empty()) {
+    return true;
   }
 
-  for (CompilationType type : types) {
-    size_t thread_id = threads_created++;
-    if (thread_id >= thread_count) {
-      thread_id = thread_id % thread_count;
-      threads[thread_id].join();
-    }
-
-    threads[thread_id] = std::thread(
-      [&](CompilationType type) {
-        const auto& req = requirements[type.arch];
+  HeaderTree new_tree = tree;
+  new_tree.restrict_headers = true;
+  new_tree.only_headers = changed;
 
-        HeaderDatabase database;
-        HeaderCompilationDatabase compilationDatabase(type, cwd, req.headers, req.dependencies);
-        ClangTool tool(compilationDatabase, req.headers);
+  HeaderTree old_tree = new_tree;
+  old_tree.header_dir = baseline_dir;
 
-        std::vector<std::unique_ptr<clang::ASTUnit>> asts;
-        tool.buildASTs(asts);
-        for (const auto& ast : asts) {
-          database.parseAST(ast.get());
-        }
-
-        std::unique_lock<std::mutex> l(mutex);
-        header_databases[type] = database;
-      },
-      type);
+  ParseCostDatabase parse_costs;
+  if (!cost_path.empty()) {
+    parse_costs.load(cost_path);
   }
 
-  if (threads_created < thread_count) {
-    threads.resize(threads_created);
-  }
+  std::vector<DeclarationDatabase> databases =
+    compileHeaderTrees(types, { old_tree, new_tree }, parse_costs, memory_budget);
 
-  for (auto& thread : threads) {
-    thread.join();
+  if (!cost_path.empty()) {
+    parse_costs.save(cost_path);
   }
 
-  return transposeHeaderDatabases(header_databases);
+  return diffDeclarations(types, databases[0], databases[1], sink);
 }
 
-static bool sanityCheck(const std::set<CompilationType>& types,
-                        const DeclarationDatabase& database) {
-  bool error = false;
-  for (auto outer : database) {
-    const std::string& symbol_name = outer.first;
-    CompilationType last_type;
-    DeclarationAvailability last_availability;
-
-    for (CompilationType type : types) {
-      auto inner = outer.second.find(type);
-      if (inner == outer.second.end()) {
-        // TODO: Check for holes.
-        continue;
-      }
-
-      const Declaration& declaration = inner->second;
-      bool found_availability = false;
-      bool availability_mismatch = false;
-      DeclarationAvailability current_availability;
-
-      // Make sure that all of the availability declarations for this symbol match.
-      for (const DeclarationLocation& location : declaration.locations) {
-        if (!found_availability) {
-          found_availability = true;
-          current_availability = location.availability;
-          continue;
-        }
-
-        if (current_availability != location.availability) {
-          availability_mismatch = true;
-          error = true;
-        }
-      }
-
-      if (availability_mismatch) {
-        printf("%s: availability mismatch for %s\n", symbol_name.c_str(), type.describe().c_str());
-        declaration.dump(getWorkingDir() + "/");
-      }
-
-      if (type.arch != last_type.arch) {
-        last_type = type;
-        last_availability = current_availability;
-        continue;
-      }
-
-      // Make sure that availability declarations are consistent across API levels for a given arch.
-      if (last_availability != current_availability) {
-        error = true;
-        printf("%s: availability mismatch between %s and %s: %s before, %s after\n",
-               symbol_name.c_str(), last_type.describe().c_str(), type.describe().c_str(),
-               last_availability.describe().c_str(), current_availability.describe().c_str());
-      }
+// Run the checks on a session, stopping at the first one that fails.
+static bool runChecks(VersionerSession& session, const DeviceLibraryDatabase* device_database,
+                      const std::string& stub_dir, DiagnosticSink& sink) {
+  // Compile first, so that the time spent checking is measured on its own.
+  session.declarations();
+  PhaseTimer phase_timer("checks");
 
-      last_type = type;
-    }
+  if (!session.sanityCheck(sink)) {
+    return false;
   }
-  return !error;
-}
 
-static bool checkVersions(const std::set<CompilationType>& compilation_types,
-                          const DeclarationDatabase& declaration_database,
-                          const NdkSymbolDatabase& symbol_database) {
-  bool failed = false;
-
-  // Map from symbol name to a map from arch to availability.
-  std::map<std::string, std::map<std::string, Declaration>> symbol_availability;
-
-  for (const auto& outer : declaration_database) {
-    const std::string& symbol_name = outer.first;
-    const std::map<CompilationType, Declaration>& declarations = outer.second;
-
-    for (const auto& inner : declarations) {
-      std::map<std::string, Declaration>& arch_map = symbol_availability[symbol_name];
-
-      if (arch_map.count(inner.first.arch) == 0) {
-        arch_map[inner.first.arch] = inner.second;
-      }
-    }
+  if (!session.checkLanguages(sink)) {
+    return false;
   }
 
-  for (const auto& outer : symbol_availability) {
-    const std::string& symbol_name = outer.first;
-    const std::map<std::string, Declaration>& arch_availability = outer.second;
-
-    std::set<std::string> missing_types;
-    size_t total_types = 0;
-    for (const auto& inner : arch_availability) {
-      const std::string& arch = inner.first;
-      const Declaration& declaration = inner.second;
-      for (int api_level : supported_levels) {
-        if (api_level < arch_min_api[arch]) {
-          continue;
-        }
-
-        const DeclarationAvailability& availability = declaration.locations.begin()->availability;
-        if (availability.introduced != 0 && api_level < availability.introduced) {
-          continue;
-        } else if (availability.obsoleted != 0 && api_level >= availability.obsoleted) {
-          continue;
-        }
-
-        ++total_types;
-
-        CompilationType type = { .arch = inner.first, .api_level = api_level };
-        type.api_level = api_level;
-
-        auto symbol_it = symbol_database.find(symbol_name);
-        if (symbol_it == symbol_database.end()) {
-          if (verbose) {
-            printf("%s: not available in any platform\n", symbol_name.c_str());
-            failed = true;
-          }
-          break;
-        }
-
-        const std::map<CompilationType, NdkSymbolType>& symbol_availability = symbol_it->second;
-        auto availability_it = symbol_availability.find(type);
-
-        if (availability_it == symbol_availability.end()) {
-          // Check to see if the symbol exists as an inline definition.
-          CompilationType type = { .arch = arch, .api_level = api_level };
-
-          const auto& declaration_map = declaration_database.find(symbol_name)->second;
-          auto it = declaration_map.find(type);
-          if (it == declaration_map.end()) {
-            printf("%s: symbol not available in %s\n", symbol_name.c_str(), type.describe().c_str());
-            continue;
-          }
-
-          if (!it->second.hasDefinition()) {
-            missing_types.insert(type.describe());
-            failed = true;
-            continue;
-          }
-        }
-
-        switch (availability_it->second) {
-          case NdkSymbolType::function:
-            if (declaration.type() != DeclarationType::function) {
-              printf("%s: symbol exists as function, declared as %s\n", symbol_name.c_str(),
-                     declarationTypeName(declaration.type()));
-            }
-            break;
-
-          case NdkSymbolType::variable:
-            if (declaration.type() != DeclarationType::variable) {
-              printf("%s: symbol exists as function, declared as %s\n", symbol_name.c_str(),
-                     declarationTypeName(declaration.type()));
-            }
-            break;
-        }
-      }
-    }
-
-    if (!missing_types.empty()) {
-      // If the symbol is missing everywhere, only warn if verbose.
-      if (missing_types.size() != total_types || verbose) {
-        printf("%s: missing in [%s]\n", symbol_name.c_str(), Join(missing_types, ", ").c_str());
-      }
-    }
+  if (!session.checkVersions(sink)) {
+    return false;
   }
 
-  using AvailabilityMismatch =
-    std::tuple<std::string, unsigned int, std::string, std::string, std::string>;
-  std::set<AvailabilityMismatch> mismatches;
-
-  // Make sure that we expose declarations for all available versions.
-  for (const auto& outer : symbol_database) {
-    const std::string& symbol_name = outer.first;
-    std::set<std::string> warned_archs;
-
-    auto decl_it = declaration_database.find(symbol_name);
-    if (decl_it == declaration_database.end()) {
-      // It's okay for a symbol to not be declared at all.
-      continue;
-    }
-
-    for (const auto& inner : outer.second) {
-      const CompilationType& type = inner.first;
-      auto symbol_it = decl_it->second.find(type);
-      if (symbol_it == decl_it->second.end()) {
-        printf("%s: failed to find declaration for %s\n", symbol_name.c_str(),
-               type.describe().c_str());
-        failed = true;
-        continue;
-      }
-
-      DeclarationAvailability availability = symbol_it->second.locations.begin()->availability;
-      if ((availability.introduced > 0 && availability.introduced > type.api_level) ||
-          (availability.obsoleted > 0 && availability.obsoleted <= type.api_level)) {
-        if (warned_archs.count(type.arch)) {
-          continue;
-        }
-
-        DeclarationLocation location =
-          *declaration_database.find(symbol_name)->second.find(type)->second.locations.begin();
-
-        mismatches.emplace(location.filename, location.line_number, symbol_name.c_str(),
-                           type.describe(), availability.describe());
-        warned_archs.insert(type.arch);
-        failed = true;
-      }
+  if (device_database) {
+    if (!checkDeviceLibraries(session.compilationTypes(), session.declarations(),
+                              *device_database, sink)) {
+      return false;
     }
   }
 
-  for (const auto& mismatch : mismatches) {
-    const std::string& filename = std::get<0>(mismatch);
-    const unsigned int line_number = std::get<1>(mismatch);
-    const std::string& symbol_name = std::get<2>(mismatch);
-    const std::string& arch = std::get<3>(mismatch);
-    const std::string& availability = std::get<4>(mismatch);
-    printf("%s: available in %s, but availability declared as %s (at %s:%u)\n", symbol_name.c_str(),
-           arch.c_str(), availability.c_str(), filename.c_str(), line_number);
+  if (!stub_dir.empty()) {
+    if (!checkStubLinkage(session.compilationTypes(), session.declarations(), stub_dir, sink)) {
+      return false;
+    }
   }
 
-  return !failed;
+  return true;
 }
 
 static void usage() {
   fprintf(stderr, "Usage: versioner [OPTION]... HEADER_PATH [DEPS_PATH]\n");
+  fprintf(stderr, "   or: versioner [OPTION]... -b HEADER_PATH[:DEPS_PATH]...\n");
+  fprintf(stderr, "   or: versioner [OPTION]... -B OLD_HEADER_PATH HEADER_PATH [DEPS_PATH]\n");
+  fprintf(stderr, "   or: versioner [OPTION]... -S STUB_PATH -L LIBRARY_PATH\n");
+  fprintf(stderr, "   or: versioner [OPTION]... -s SOCKET_PATH HEADER_PATH [DEPS_PATH]\n");
   fprintf(stderr, "Version headers at HEADER_PATH, with DEPS_PATH/* on the include path\n");
   fprintf(stderr, "\n");
   fprintf(stderr, "Target specification (defaults to all):\n");
   fprintf(stderr, "  -a API_LEVEL\tbuild with specified API level (can be repeated)\n");
-  fprintf(stderr, "    \t\tvalid levels are %s\n", Join(supported_levels).c_str());
+  fprintf(stderr, "    \t\tvalid levels are %s\n", Join(supportedLevels()).c_str());
   fprintf(stderr, "  -r ARCH\tbuild with specified architecture (can be repeated)\n");
-  fprintf(stderr, "    \t\tvalid architectures are %s\n", Join(supported_archs).c_str());
+  fprintf(stderr, "    \t\tvalid architectures are %s\n", Join(supportedArchs()).c_str());
   fprintf(stderr, "\n");
   fprintf(stderr, "Validation:\n");
   fprintf(stderr, "  -p PLATFORM_PATH\tcompare against NDK platform at PLATFORM_PATH\n");
+  fprintf(stderr, "  -L LIBRARY_PATH\tcompare against device libraries at LIBRARY_PATH\n");
+  fprintf(stderr, "  -S STUB_PATH\tcheck that declarations link against the NDK stub libraries\n");
+  fprintf(stderr, "    \t\tat STUB_PATH, or without HEADER_PATH, compare the stubs\n");
+  fprintf(stderr, "    \t\tagainst the device libraries (requires -L)\n");
   fprintf(stderr, "  -d\t\tdump symbol availability in libraries\n");
+  fprintf(stderr, "  -l\t\tonly run a quick lexical check of availability annotations\n");
+  fprintf(stderr, "    \t\tagainst the NDK platform (requires -p)\n");
   fprintf(stderr, "  -v\t\tenable verbose warnings\n");
+  fprintf(stderr, "  -j\t\treport problems as JSON Lines, one object per problem\n");
+  fprintf(stderr, "  -x\t\talso compile the headers as C++, and check that C++ sees the same\n");
+  fprintf(stderr, "    \t\tsymbols with the same availability as C\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Comparison:\n");
+  fprintf(stderr, "  -B OLD_HEADER_PATH\treport how availability differs from the headers at\n");
+  fprintf(stderr, "    \t\tOLD_HEADER_PATH, only reparsing the headers that differ\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Modification:\n");
+  fprintf(stderr, "  -f\t\tadd missing __INTRODUCED_IN annotations to the headers in place,\n");
+  fprintf(stderr, "    \t\tbased on the NDK platform (requires -p)\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Generation:\n");
+  fprintf(stderr, "  -g OUTPUT_PATH\twrite the symbol lists and stub libraries that the headers\n");
+  fprintf(stderr, "    \t\tdeclare to OUTPUT_PATH/platforms and OUTPUT_PATH/stubs\n");
+  fprintf(stderr, "  -o OUTPUT_PATH\twrite a copy of the headers for each API level, without\n");
+  fprintf(stderr, "    \t\tthe declarations unavailable there, to OUTPUT_PATH/platforms\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Serving:\n");
+  fprintf(stderr, "  -s SOCKET_PATH\tcompile the headers once, then answer availability queries\n");
+  fprintf(stderr, "    \t\tof the form 'SYMBOL ARCH API_LEVEL' on a Unix socket\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Scheduling:\n");
+  fprintf(stderr, "  -m MEMORY_MB\tonly start compilations while memory use is under MEMORY_MB\n");
+  fprintf(stderr, "    \t\t(defaults to three quarters of physical memory)\n");
+  fprintf(stderr, "  -b\t\tbatch mode: check several header trees in one run, parsing the\n");
+  fprintf(stderr, "    \t\tplatform once and compiling every tree on one worker pool\n");
+  fprintf(stderr, "  -t COST_PATH\tload and save per-header parse times at COST_PATH, and use\n");
+  fprintf(stderr, "    \t\tthem to schedule the most expensive compilations first\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Monitoring:\n");
+  fprintf(stderr, "  -M METRICS_PATH\twrite timings and counts for the run to\n");
+  fprintf(stderr, "    \t\tMETRICS_PATH, in the Prometheus text format\n");
   exit(1);
 }
 
@@ -487,11 +226,25 @@ int main(int argc, char** argv) {
   std::string cwd = getWorkingDir() + "/";
   bool default_args = true;
   std::string platform_dir;
+  std::string library_dir;
+  std::string stub_dir;
+  std::string cost_path;
+  std::string metrics_path;
+  std::string baseline_dir;
+  std::string socket_path;
+  std::string output_dir;
+  std::string flatten_dir;
+  uint64_t memory_budget = 0;
+  bool prescan = false;
+  bool annotate = false;
+  bool batch = false;
+  bool cxx = false;
+  DiagnosticFormat format = DiagnosticFormat::text;
   std::set<std::string> selected_architectures;
   std::set<int> selected_levels;
 
   int c;
-  while ((c = getopt(argc, argv, "a:r:p:n:duv")) != -1) {
+  while ((c = getopt(argc, argv, "a:r:g:o:p:m:n:s:t:B:L:M:S:bdfjluvx")) != -1) {
     default_args = false;
     switch (c) {
       case 'a': {
@@ -501,7 +254,7 @@ int main(int argc, char** argv) {
           usage();
         }
 
-        if (supported_levels.count(api_level) == 0) {
+        if (!isSupportedLevel(api_level)) {
           errx(1, "unsupported API level %d", api_level);
         }
 
@@ -510,13 +263,23 @@ int main(int argc, char** argv) {
       }
 
       case 'r': {
-        if (supported_archs.count(optarg) == 0) {
+        if (!findArch(optarg)) {
           errx(1, "unsupported architecture: %s", optarg);
         }
         selected_architectures.insert(optarg);
         break;
       }
 
+      case 'm': {
+        char* end;
+        unsigned long long megabytes = strtoull(optarg, &end, 10);
+        if (end == optarg || strlen(end) > 0 || megabytes == 0) {
+          usage();
+        }
+        memory_budget = megabytes << 20;
+        break;
+      }
+
       case 'p': {
         if (!platform_dir.empty()) {
           usage();
@@ -534,51 +297,272 @@ int main(int argc, char** argv) {
         break;
       }
 
+      case 'B': {
+        if (!baseline_dir.empty()) {
+          usage();
+        }
+
+        baseline_dir = optarg;
+
+        struct stat st;
+        if (stat(baseline_dir.c_str(), &st) != 0) {
+          err(1, "failed to stat baseline header directory '%s'", baseline_dir.c_str());
+        }
+        if (!S_ISDIR(st.st_mode)) {
+          errx(1, "%s is not a directory", optarg);
+        }
+        break;
+      }
+
+      case 'L': {
+        if (!library_dir.empty()) {
+          usage();
+        }
+
+        library_dir = optarg;
+
+        struct stat st;
+        if (stat(library_dir.c_str(), &st) != 0) {
+          err(1, "failed to stat library directory '%s'", library_dir.c_str());
+        }
+        if (!S_ISDIR(st.st_mode)) {
+          errx(1, "%s is not a directory", optarg);
+        }
+        break;
+      }
+
+      case 'S': {
+        if (!stub_dir.empty()) {
+          usage();
+        }
+
+        stub_dir = optarg;
+
+        struct stat st;
+        if (stat(stub_dir.c_str(), &st) != 0) {
+          err(1, "failed to stat stub library directory '%s'", stub_dir.c_str());
+        }
+        if (!S_ISDIR(st.st_mode)) {
+          errx(1, "%s is not a directory", optarg);
+        }
+        break;
+      }
+
+      case 'b':
+        batch = true;
+        break;
+
+      case 'f':
+        annotate = true;
+        break;
+
+      case 'j':
+        format = DiagnosticFormat::json;
+        break;
+
+      case 'l':
+        prescan = true;
+        break;
+
+      case 'g':
+        if (!output_dir.empty()) {
+          usage();
+        }
+        output_dir = optarg;
+        break;
+
+      case 'o':
+        if (!flatten_dir.empty()) {
+          usage();
+        }
+        flatten_dir = optarg;
+        break;
+
+      case 's':
+        if (!socket_path.empty()) {
+          usage();
+        }
+        socket_path = optarg;
+        break;
+
+      case 't':
+        if (!cost_path.empty()) {
+          usage();
+        }
+        cost_path = optarg;
+        break;
+
+      case 'M':
+        if (!metrics_path.empty()) {
+          usage();
+        }
+        metrics_path = optarg;
+        break;
+
       case 'v':
         verbose = true;
         break;
 
+      case 'x':
+        cxx = true;
+        break;
+
       default:
         usage();
         break;
     }
   }
 
-  if (argc - optind > 2 || optind >= argc) {
+  bool check_drift = !stub_dir.empty() && optind == argc;
+  if (check_drift) {
+    if (library_dir.empty()) {
+      usage();
+    }
+  } else if (optind >= argc || (!batch && argc - optind > 2)) {
     usage();
   }
 
-  if (selected_levels.empty()) {
-    selected_levels = supported_levels;
+  if (!baseline_dir.empty() && (batch || prescan || annotate || !stub_dir.empty())) {
+    errx(1, "-B can't be combined with -b, -f, -l, or -S");
+  }
+
+  if (!socket_path.empty() &&
+      (batch || prescan || annotate || !baseline_dir.empty() || !stub_dir.empty())) {
+    errx(1, "-s can't be combined with -b, -B, -f, -l, or -S");
+  }
+
+  if ((!output_dir.empty() || !flatten_dir.empty()) &&
+      (batch || prescan || annotate || !baseline_dir.empty() || !stub_dir.empty() ||
+       !socket_path.empty())) {
+    errx(1, "-g and -o can't be combined with -b, -B, -f, -l, -s, or -S");
+  }
+
+  if (cxx && (prescan || annotate || !baseline_dir.empty() || !socket_path.empty() ||
+              !output_dir.empty() || !flatten_dir.empty())) {
+    errx(1, "-x can't be combined with -B, -f, -g, -l, -o, or -s");
+  }
+
+  if (prescan && platform_dir.empty()) {
+    errx(1, "-l requires an NDK platform to compare against (-p)");
+  }
+
+  if (annotate && platform_dir.empty()) {
+    errx(1, "-f requires an NDK platform to compare against (-p)");
   }
 
   if (selected_architectures.empty()) {
-    selected_architectures = supported_archs;
+    selected_architectures = supportedArchs();
   }
 
-  std::string dependencies = (argc - optind == 2) ? argv[optind + 1] : "";
-  std::set<CompilationType> compilation_types;
-  DeclarationDatabase declaration_database;
-  NdkSymbolDatabase symbol_database;
+  MetricsExport metrics_export(metrics_path);
+  DiagnosticWriter writer(stdout, format, cwd);
 
-  compilation_types = generateCompilationTypes(selected_architectures, selected_levels);
+  if (check_drift) {
+    return checkLibraryDrift(selected_architectures, stub_dir, library_dir, writer) ? 0 : 1;
+  }
 
-  // Do this before compiling so that we can early exit if the platforms don't match what we expect.
-  if (!platform_dir.empty()) {
-    symbol_database = parsePlatforms(compilation_types, platform_dir);
+  std::vector<HeaderTree> trees;
+  if (batch) {
+    for (int i = optind; i < argc; ++i) {
+      std::string arg = argv[i];
+      size_t separator = arg.find(':');
+      HeaderTree tree = { .header_dir = arg.substr(0, separator) };
+      if (separator != std::string::npos) {
+        tree.dependency_dir = arg.substr(separator + 1);
+      }
+      trees.push_back(tree);
+    }
+  } else {
+    trees.push_back({ .header_dir = argv[optind],
+                      .dependency_dir = (argc - optind == 2) ? argv[optind + 1] : "" });
   }
 
-  declaration_database = compileHeaders(compilation_types, argv[optind], dependencies);
+  if (!baseline_dir.empty()) {
+    std::set<CompilationType> types = generateCompilationTypes(
+      selected_architectures, selected_levels.empty() ? supportedLevels() : selected_levels);
+    return diffBaseline(types, trees[0], baseline_dir, cost_path, memory_budget, writer) ? 0 : 1;
+  }
 
-  if (!sanityCheck(compilation_types, declaration_database)) {
-    return 1;
+  std::vector<std::unique_ptr<VersionerSession>> sessions;
+  for (const HeaderTree& tree : trees) {
+    VersionerOptions options;
+    options.header_dir = tree.header_dir;
+    options.dependency_dir = tree.dependency_dir;
+    options.platform_dir = platform_dir;
+    options.archs = selected_architectures;
+    options.levels = selected_levels;
+    options.cost_path = cost_path;
+    options.memory_budget = memory_budget;
+    options.cxx = cxx;
+    std::string error;
+    std::unique_ptr<VersionerSession> session = VersionerSession::create(options, &error);
+    if (!session) {
+      errx(1, "%s", error.c_str());
+    }
+    sessions.push_back(std::move(session));
+  }
+
+  if (!socket_path.empty()) {
+    return serveQueries(*sessions[0], socket_path) ? 0 : 1;
   }
 
-  if (!platform_dir.empty()) {
-    if (!checkVersions(compilation_types, declaration_database, symbol_database)) {
+  // Don't generate anything from declarations that don't agree with each other.
+  if (!output_dir.empty() || !flatten_dir.empty()) {
+    if (!sessions[0]->sanityCheck(writer)) {
+      return 1;
+    }
+    if (!output_dir.empty()) {
+      generatePlatform(sessions[0]->compilationTypes(), sessions[0]->declarations(), output_dir);
+    }
+    if (!flatten_dir.empty() &&
+        !flattenHeaders(sessions[0]->compilationTypes(), sessions[0]->declarations(),
+                        trees[0].header_dir, flatten_dir, writer)) {
       return 1;
     }
+    return 0;
+  }
+
+  DeviceLibraryDatabase device_database;
+  if (!library_dir.empty()) {
+    device_database = parseDeviceLibraries(selected_architectures, library_dir);
+  }
+
+  // Compiling the headers also parses the platform on the side, and checks each architecture as it
+  // finishes, so that only the checks that need everything are left once the last type is done.
+  if (!prescan && sessions.size() > 1) {
+    std::vector<VersionerSession*> pending;
+    for (const auto& session : sessions) {
+      pending.push_back(session.get());
+    }
+    std::string error;
+    if (!prepareSessions(pending, &error)) {
+      errx(1, "%s", error.c_str());
+    }
+  }
+
+  bool failed = false;
+  for (const auto& session : sessions) {
+    const std::string& header_dir = session->getOptions().header_dir;
+    TreeDiagnosticSink sink(writer, batch ? header_dir : "");
+
+    bool result;
+    if (prescan) {
+      result = prescanHeaders(session->compilationTypes(), header_dir,
+                              sessions[0]->platformSymbols(), sink);
+    } else if (annotate) {
+      result = annotateHeaders(session->compilationTypes(), session->declarations(),
+                               sessions[0]->platformSymbols(), sink);
+    } else {
+      result =
+        runChecks(*session, library_dir.empty() ? nullptr : &device_database, stub_dir, sink);
+    }
+
+    if (batch) {
+      writer.flush();
+      fprintf(stderr, "%s: %s\n", header_dir.c_str(), result ? "ok" : "failed");
+    }
+    failed |= !result;
   }
 
-  return 0;
+  return failed ? 1 : 0;
 }
@@ -28,44 +28,111 @@
 
 #pragma once
 
-#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <iterator>
 #include <set>
 #include <string>
-#include <unordered_map>
 
 extern bool verbose;
 
-static const std::set<std::string> supported_archs = {
-  "arm", "arm64", "mips", "mips64", "x86", "x86_64",
+// These tables are constexpr so that they don't need to be constructed at startup in every
+// translation unit that includes this.
+
+enum class Arch : uint8_t {
+  arm,
+  arm64,
+  mips,
+  mips64,
+  x86,
+  x86_64,
 };
 
-static std::unordered_map<std::string, std::string> arch_targets = {
-  { "arm", "arm-linux-androideabi" },
-  { "arm64", "aarch64-linux-android" },
-  { "mips", "mipsel-linux-android" },
-  { "mips64", "mips64el-linux-android" },
-  { "x86", "i686-linux-android" },
-  { "x86_64", "x86_64-linux-android" },
+struct ArchInfo {
+  Arch arch;
+  const char* name;
+
+  // The clang target triple.
+  const char* target;
+
+  int min_api;
+  bool lp64;
 };
 
-static const std::set<int> supported_levels = { 9, 12, 13, 14, 15, 16, 17, 18, 19, 21, 23, 24 };
+// Indexed by Arch.
+static constexpr ArchInfo arch_table[] = {
+  { Arch::arm, "arm", "arm-linux-androideabi", 9, false },
+  { Arch::arm64, "arm64", "aarch64-linux-android", 21, true },
+  { Arch::mips, "mips", "mipsel-linux-android", 9, false },
+  { Arch::mips64, "mips64", "mips64el-linux-android", 21, true },
+  { Arch::x86, "x86", "i686-linux-android", 9, false },
+  { Arch::x86_64, "x86_64", "x86_64-linux-android", 21, true },
+};
+
+static constexpr uint32_t archBit(Arch arch) {
+  return 1U << static_cast<uint32_t>(arch);
+}
+
+static constexpr uint32_t all_archs = (1U << (sizeof(arch_table) / sizeof(arch_table[0]))) - 1;
+
+// Look up a supported architecture by name, returning nullptr if it isn't one.
+static inline const ArchInfo* findArch(const std::string& name) {
+  for (const ArchInfo& info : arch_table) {
+    if (name == info.name) {
+      return &info;
+    }
+  }
+  return nullptr;
+}
+
+// The minimum API level of an architecture, or 0 if it isn't supported.
+static inline int archMinApi(const std::string& name) {
+  const ArchInfo* info = findArch(name);
+  return info ? info->min_api : 0;
+}
 
-// Non-const for the convenience of being able to index with operator[].
-static std::map<std::string, int> arch_min_api = {
-  { "arm", 9 },
-  { "arm64", 21 },
-  { "mips", 9 },
-  { "mips64", 21 },
-  { "x86", 9 },
-  { "x86_64", 21 },
+static inline std::set<std::string> supportedArchs() {
+  std::set<std::string> result;
+  for (const ArchInfo& info : arch_table) {
+    result.insert(info.name);
+  }
+  return result;
+}
+
+static constexpr int supported_level_list[] = { 9, 12, 13, 14, 15, 16, 17, 18, 19, 21, 23, 24 };
+
+static constexpr uint64_t levelBit(int api_level) {
+  return api_level >= 0 && api_level < 64 ? uint64_t(1) << api_level : 0;
+}
+
+static constexpr uint64_t makeLevelMask() {
+  uint64_t result = 0;
+  for (int api_level : supported_level_list) {
+    result |= levelBit(api_level);
+  }
+  return result;
+}
+
+static constexpr uint64_t supported_level_mask = makeLevelMask();
+
+static constexpr bool isSupportedLevel(int api_level) {
+  return (supported_level_mask & levelBit(api_level)) != 0;
+}
+
+static inline std::set<int> supportedLevels() {
+  return std::set<int>(std::begin(supported_level_list), std::end(supported_level_list));
+}
+
+struct BlacklistedHeader {
+  const char* path;
+  uint32_t archs;
 };
 
-static const std::unordered_map<std::string, std::set<std::string>> header_blacklist = {
+static constexpr BlacklistedHeader header_blacklist[] = {
   // Internal header.
-  { "sys/_system_properties.h", supported_archs },
+  { "sys/_system_properties.h", all_archs },
 
   // time64.h #errors when included on LP64 archs.
-  { "time64.h", { "arm64", "mips64", "x86_64" } },
+  { "time64.h", archBit(Arch::arm64) | archBit(Arch::mips64) | archBit(Arch::x86_64) },
 };
-
-